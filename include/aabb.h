@@ -1,5 +1,14 @@
 #pragma once
 
+#include <algorithm>
+#include <limits>
+
+#include "ray.h"
+
+// exit distances are scaled up by this to account for rounding in the slab test, so rays grazing a box edge
+// can't slip through the gap between two neighbouring boxes
+constexpr float slab_exit_scale = 1.0f + 2.0f * (3.0f * std::numeric_limits<float>::epsilon() * 0.5f) / (1.0f - 3.0f * std::numeric_limits<float>::epsilon() * 0.5f);
+
 struct AABB {
     glm::vec3 min, max;
     
@@ -11,6 +20,25 @@ struct AABB {
         return max - center();
     }
     
+    float surface_area() const {
+        const glm::vec3 size = max - min;
+        return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+    }
+    
+    void grow(const glm::vec3 point) {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+    }
+    
+    void grow(const AABB other) {
+        min = glm::min(min, other.min);
+        max = glm::max(max, other.max);
+    }
+    
+    static AABB empty() {
+        return {glm::vec3(std::numeric_limits<float>::max()), glm::vec3(std::numeric_limits<float>::lowest())};
+    }
+    
     bool contains(const glm::vec3 point) const {
         return glm::all(glm::lessThan(point, max)) && glm::all(glm::greaterThan(point, min));
     }
@@ -25,27 +53,50 @@ struct AABB {
     }
     
     bool contains(const Ray& ray) const {
-        const float t1 = (min.x - ray.origin.x) / ray.direction.x;
-        const float t2 = (max.x - ray.origin.x) / ray.direction.x;
-        const float t3 = (min.y - ray.origin.y) / ray.direction.y;
-        const float t4 = (max.y - ray.origin.y) / ray.direction.y;
-        const float t5 = (min.z - ray.origin.z) / ray.direction.z;
-        const float t6 = (max.z - ray.origin.z) / ray.direction.z;
-        
-        const float tmin = std::min(std::max(std::min(t1, t2), std::min(t3, t4)), std::min(t5, t6));
-        const float tmax = std::min(std::min(std::max(t1, t2), std::max(t3, t4)), std::max(t5, t6));
-        
-        // if tmax < 0, ray (line) is intersecting AABB, but whole AABB is behing us
-        //if(tmax < 0)
-        //    return false;
-        
-        // if tmin > tmax, ray doesn't intersect AABB
-        if(tmin > tmax)
+        float t_entry, t_exit;
+        return intersect(ray, std::numeric_limits<float>::infinity(), t_entry, t_exit);
+    }
+    
+    // slab test using the ray's cached inverse direction. reports where the ray enters and leaves the box, and
+    // rejects boxes that lie entirely behind the origin or start beyond t_max
+    bool intersect(const Ray& ray, const float t_max, float& t_entry, float& t_exit) const {
+        const glm::vec3 bounds[2] = {min, max};
+        
+        float tmin = (bounds[ray.sign[0]].x - ray.origin.x) * ray.inverse_direction.x;
+        float tmax = (bounds[1 - ray.sign[0]].x - ray.origin.x) * ray.inverse_direction.x * slab_exit_scale;
+        
+        const float tymin = (bounds[ray.sign[1]].y - ray.origin.y) * ray.inverse_direction.y;
+        const float tymax = (bounds[1 - ray.sign[1]].y - ray.origin.y) * ray.inverse_direction.y * slab_exit_scale;
+        
+        if(tmin > tymax || tymin > tmax)
             return false;
         
-        if(tmin < 0.0f)
-            return true;
-
-        return true;
+        // written so a NaN from 0 * inf (origin exactly on a slab of an axis-aligned ray) is ignored
+        if(tymin > tmin)
+            tmin = tymin;
+        if(tymax < tmax)
+            tmax = tymax;
+        
+        const float tzmin = (bounds[ray.sign[2]].z - ray.origin.z) * ray.inverse_direction.z;
+        const float tzmax = (bounds[1 - ray.sign[2]].z - ray.origin.z) * ray.inverse_direction.z * slab_exit_scale;
+        
+        if(tmin > tzmax || tzmin > tmax)
+            return false;
+        
+        if(tzmin > tmin)
+            tmin = tzmin;
+        if(tzmax < tmax)
+            tmax = tzmax;
+        
+        t_entry = tmin;
+        t_exit = tmax;
+        
+        // the whole box is behind us, or starts past the closest hit so far
+        return tmax >= 0.0f && tmin <= t_max;
+    }
+    
+    bool intersect(const Ray& ray, const float t_max, float& t_entry) const {
+        float t_exit;
+        return intersect(ray, t_max, t_entry, t_exit);
     }
 };
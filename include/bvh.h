@@ -0,0 +1,352 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "aabb.h"
+#include "thread_pool.h"
+
+// number of buckets centroids are sorted into when evaluating split candidates
+constexpr int bvh_num_bins = 16;
+
+// leaves are never larger than this, even if the SAH says splitting isn't worth it, unless the tree reached
+// bvh_max_depth
+constexpr int bvh_max_leaf_size = 8;
+
+// deepest a tree is allowed to get, which also bounds the traversal stack
+constexpr int bvh_max_depth = 64;
+
+// parallel builds bin ranges at least this large on every worker, in chunks of bvh_parallel_chunk_size, and hand
+// anything smaller to a single worker
+constexpr uint32_t bvh_parallel_min_primitives = 32768;
+constexpr uint32_t bvh_parallel_chunk_size = 16384;
+
+// relative costs of visiting a node and of testing a single primitive, used by the SAH
+constexpr float bvh_traversal_cost = 1.0f;
+constexpr float bvh_intersection_cost = 1.0f;
+
+/*
+ Nodes are stored depth-first in one array, so the first child of an interior node always directly follows its parent
+ and only the second child needs an index. Leaves point into the primitive array instead, which is reordered during the
+ build so every leaf covers one contiguous range.
+ */
+struct alignas(32) BVHNode {
+    AABB extent;
+    
+    // second child for interior nodes, first primitive for leaves
+    uint32_t offset = 0;
+    
+    // number of primitives in a leaf, zero for interior nodes
+    uint32_t count = 0;
+    
+    bool is_leaf() const {
+        return count > 0;
+    }
+};
+
+static_assert(sizeof(BVHNode) == 32, "BVH nodes should fit twice into a cache line");
+
+/*
+ Bounding volume hierarchy built with the surface area heuristic. UnderlyingType only needs an `extent` member,
+ the same requirement the octree has, so it can hold triangles as well as whole objects.
+ */
+template<typename UnderlyingType>
+struct BVH {
+    std::vector<BVHNode> nodes;
+    std::vector<UnderlyingType> primitives;
+    
+    // how many primitives a leaf can test for the price of one, e.g. the width of a simd intersection kernel
+    int group_size = 1;
+    
+    // with a pool, large ranges are binned on every worker and the subtrees below them are built as separate jobs. the
+    // tree comes out the same either way. has to be called from outside the pool, since it waits for it
+    explicit BVH(std::vector<UnderlyingType> objects, const int group_size = 1, ThreadPool* pool = nullptr) : primitives(std::move(objects)), group_size(group_size) {
+        if(primitives.empty())
+            return;
+        
+        nodes.reserve(2 * primitives.size());
+        
+        if(pool != nullptr && primitives.size() >= bvh_parallel_min_primitives)
+            build_parallel(*pool);
+        else
+            build(nodes, 0, static_cast<uint32_t>(primitives.size()), 0);
+        
+        nodes.shrink_to_fit();
+    }
+    
+private:
+    struct Bin {
+        AABB extent = AABB::empty();
+        int count = 0;
+    };
+    
+    using Bins = std::array<std::array<Bin, bvh_num_bins>, 3>;
+    
+    // a node of the upper part of a parallel build, or a whole subtree below it that one worker builds on its own
+    struct PendingNode {
+        AABB extent = AABB::empty();
+        uint32_t begin = 0, end = 0;
+        int depth = 0;
+        
+        bool is_subtree = false;
+        std::vector<BVHNode> subtree;
+    };
+    
+    // bounds of the primitives in [begin, end) and of their centers
+    void measure(const uint32_t begin, const uint32_t end, AABB& extent, AABB& centroid_extent) const {
+        for(uint32_t i = begin; i < end; i++) {
+            extent.grow(primitives[i].extent);
+            centroid_extent.grow(primitives[i].extent.center());
+        }
+    }
+    
+    // sorts the centroids of [begin, end) into bins along every axis the centroids spread out on
+    void fill_bins(const uint32_t begin, const uint32_t end, const AABB centroid_extent, Bins& bins) const {
+        const glm::vec3 centroid_size = centroid_extent.max - centroid_extent.min;
+        
+        for(uint32_t i = begin; i < end; i++) {
+            for(int axis = 0; axis < 3; axis++) {
+                if(centroid_size[axis] <= 0.0f)
+                    continue;
+                
+                auto& bin = bins[axis][bin_index(primitives[i], centroid_extent, axis)];
+                bin.extent.grow(primitives[i].extent);
+                bin.count++;
+            }
+        }
+    }
+    
+    // finds the cheapest split plane along any axis by evaluating the SAH at every boundary between bins. returns false
+    // if the node is better off as a leaf, otherwise partitions [begin, end) and sets middle to where the second
+    // child's primitives start
+    bool split(const uint32_t begin, const uint32_t end, const int depth, const AABB extent, const AABB centroid_extent, const Bins& bins, uint32_t& middle) {
+        const uint32_t count = end - begin;
+        if(count <= 1 || depth >= bvh_max_depth - 1)
+            return false;
+        
+        int best_axis = -1, best_split = 0;
+        float best_cost = std::numeric_limits<float>::max();
+        
+        const glm::vec3 centroid_size = centroid_extent.max - centroid_extent.min;
+        
+        for(int axis = 0; axis < 3; axis++) {
+            // all centroids lie on the same plane, nothing to split here
+            if(centroid_size[axis] <= 0.0f)
+                continue;
+            
+            // sweep from the right first, so the left sweep can compute the cost in one pass
+            std::array<float, bvh_num_bins> right_area = {};
+            std::array<int, bvh_num_bins> right_count = {};
+            
+            AABB right_extent = AABB::empty();
+            int right_total = 0;
+            for(int i = bvh_num_bins - 1; i > 0; i--) {
+                right_extent.grow(bins[axis][i].extent);
+                right_total += bins[axis][i].count;
+                
+                right_area[i] = right_total > 0 ? right_extent.surface_area() : 0.0f;
+                right_count[i] = right_total;
+            }
+            
+            AABB left_extent = AABB::empty();
+            int left_total = 0;
+            for(int i = 0; i < bvh_num_bins - 1; i++) {
+                left_extent.grow(bins[axis][i].extent);
+                left_total += bins[axis][i].count;
+                
+                if(left_total == 0 || right_count[i + 1] == 0)
+                    continue;
+                
+                const float cost = groups(left_total) * left_extent.surface_area() + groups(right_count[i + 1]) * right_area[i + 1];
+                if(cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_split = i;
+                }
+            }
+        }
+        
+        // every centroid is in the same spot, so there's no plane to split at. halving the range in whatever order it
+        // is still keeps the leaves small
+        if(best_axis == -1) {
+            if(count <= static_cast<uint32_t>(bvh_max_leaf_size))
+                return false;
+            
+            middle = begin + count / 2;
+            return true;
+        }
+        
+        const float leaf_cost = bvh_intersection_cost * groups(count);
+        const float split_cost = bvh_traversal_cost + bvh_intersection_cost * best_cost / extent.surface_area();
+        
+        if(split_cost >= leaf_cost && count <= static_cast<uint32_t>(bvh_max_leaf_size))
+            return false;
+        
+        const auto partitioned = std::partition(primitives.begin() + begin, primitives.begin() + end, [&](const UnderlyingType& object) {
+            return bin_index(object, centroid_extent, best_axis) <= best_split;
+        });
+        middle = static_cast<uint32_t>(partitioned - primitives.begin());
+        
+        return true;
+    }
+    
+    // appends the subtree over [begin, end) to out depth-first, with child indices relative to the start of out
+    void build(std::vector<BVHNode>& out, const uint32_t begin, const uint32_t end, const int depth) {
+        const uint32_t node_index = static_cast<uint32_t>(out.size());
+        out.emplace_back();
+        
+        AABB extent = AABB::empty();
+        AABB centroid_extent = AABB::empty();
+        measure(begin, end, extent, centroid_extent);
+        
+        Bins bins = {};
+        fill_bins(begin, end, centroid_extent, bins);
+        
+        out[node_index].extent = extent;
+        
+        uint32_t middle;
+        if(!split(begin, end, depth, extent, centroid_extent, bins, middle)) {
+            out[node_index].offset = begin;
+            out[node_index].count = end - begin;
+            return;
+        }
+        
+        build(out, begin, middle, depth + 1);
+        
+        out[node_index].offset = static_cast<uint32_t>(out.size());
+        build(out, middle, end, depth + 1);
+    }
+    
+    // calls function(chunk_begin, chunk_end, chunk) for slices of [begin, end) on the pool and waits for all of them
+    template<typename Function>
+    static void for_each_chunk(ThreadPool& pool, const uint32_t begin, const uint32_t end, Function function) {
+        const uint32_t num_chunks = (end - begin + bvh_parallel_chunk_size - 1) / bvh_parallel_chunk_size;
+        
+        for(uint32_t chunk = 0; chunk < num_chunks; chunk++) {
+            const uint32_t chunk_begin = begin + chunk * bvh_parallel_chunk_size;
+            const uint32_t chunk_end = std::min(chunk_begin + bvh_parallel_chunk_size, end);
+            
+            pool.submit([=, &function] { function(chunk_begin, chunk_end, chunk); });
+        }
+        
+        pool.wait();
+    }
+    
+    // splits the upper levels the same way build would, only binning each node on all workers. ranges that got small
+    // enough are left to build_parallel to hand out as a whole
+    void split_upper(ThreadPool& pool, std::vector<PendingNode>& pending, const uint32_t begin, const uint32_t end, const int depth) {
+        const size_t index = pending.size();
+        
+        PendingNode& node = pending.emplace_back();
+        node.begin = begin;
+        node.end = end;
+        node.depth = depth;
+        
+        if(end - begin < bvh_parallel_min_primitives) {
+            pending[index].is_subtree = true;
+            return;
+        }
+        
+        // per chunk first, merged afterwards. only minimums, maximums and counts are merged, so the result is exactly
+        // what a single pass would have found
+        const uint32_t num_chunks = (end - begin + bvh_parallel_chunk_size - 1) / bvh_parallel_chunk_size;
+        std::vector<std::pair<AABB, AABB>> chunk_extents(num_chunks, {AABB::empty(), AABB::empty()});
+        
+        for_each_chunk(pool, begin, end, [&](const uint32_t chunk_begin, const uint32_t chunk_end, const uint32_t chunk) {
+            measure(chunk_begin, chunk_end, chunk_extents[chunk].first, chunk_extents[chunk].second);
+        });
+        
+        AABB extent = AABB::empty();
+        AABB centroid_extent = AABB::empty();
+        for(const auto& [chunk_extent, chunk_centroid_extent] : chunk_extents) {
+            extent.grow(chunk_extent);
+            centroid_extent.grow(chunk_centroid_extent);
+        }
+        
+        std::vector<Bins> chunk_bins(num_chunks, Bins{});
+        
+        for_each_chunk(pool, begin, end, [&](const uint32_t chunk_begin, const uint32_t chunk_end, const uint32_t chunk) {
+            fill_bins(chunk_begin, chunk_end, centroid_extent, chunk_bins[chunk]);
+        });
+        
+        Bins bins = {};
+        for(const Bins& chunk : chunk_bins) {
+            for(int axis = 0; axis < 3; axis++) {
+                for(int i = 0; i < bvh_num_bins; i++) {
+                    bins[axis][i].extent.grow(chunk[axis][i].extent);
+                    bins[axis][i].count += chunk[axis][i].count;
+                }
+            }
+        }
+        
+        pending[index].extent = extent;
+        
+        uint32_t middle;
+        if(!split(begin, end, depth, extent, centroid_extent, bins, middle)) {
+            pending[index].is_subtree = true;
+            return;
+        }
+        
+        split_upper(pool, pending, begin, middle, depth + 1);
+        split_upper(pool, pending, middle, end, depth + 1);
+    }
+    
+    void build_parallel(ThreadPool& pool) {
+        std::vector<PendingNode> pending;
+        split_upper(pool, pending, 0, static_cast<uint32_t>(primitives.size()), 0);
+        
+        // the subtrees cover disjoint ranges of primitives, so they can be partitioned at the same time
+        for(PendingNode& node : pending) {
+            if(node.is_subtree)
+                pool.submit([this, &node] { build(node.subtree, node.begin, node.end, node.depth); });
+        }
+        
+        pool.wait();
+        
+        splice(pending, 0);
+    }
+    
+    // appends the pending node at index and everything below it to nodes in depth-first order, returns the index of
+    // the pending node that follows its subtree
+    size_t splice(std::vector<PendingNode>& pending, const size_t index) {
+        PendingNode& node = pending[index];
+        
+        if(node.is_subtree) {
+            const uint32_t base = static_cast<uint32_t>(nodes.size());
+            
+            for(BVHNode subtree_node : node.subtree) {
+                if(!subtree_node.is_leaf())
+                    subtree_node.offset += base;
+                
+                nodes.push_back(subtree_node);
+            }
+            
+            node.subtree = {};
+            
+            return index + 1;
+        }
+        
+        const uint32_t node_index = static_cast<uint32_t>(nodes.size());
+        nodes.emplace_back();
+        nodes[node_index].extent = node.extent;
+        
+        const size_t second_child = splice(pending, index + 1);
+        
+        nodes[node_index].offset = static_cast<uint32_t>(nodes.size());
+        
+        return splice(pending, second_child);
+    }
+    
+    float groups(const int count) const {
+        return static_cast<float>((count + group_size - 1) / group_size);
+    }
+    
+    static int bin_index(const UnderlyingType& object, const AABB centroid_extent, const int axis) {
+        const float relative = (object.extent.center()[axis] - centroid_extent.min[axis]) / (centroid_extent.max[axis] - centroid_extent.min[axis]);
+        
+        return std::min(static_cast<int>(relative * bvh_num_bins), bvh_num_bins - 1);
+    }
+};
@@ -1,22 +1,90 @@
 #pragma once
 
 #include <glm/glm.hpp>
-#include <array>
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
 
-template<class T, int Width, int Height>
+// rows start on a cache line, so two threads writing neighbouring tiles never share one across a row boundary
+constexpr size_t image_alignment = 64;
+
+/*
+ Pixels of any size picked at runtime, kept on the heap one padded row after another. pitch() is the distance between
+ two rows in elements, which is also what GL_UNPACK_ROW_LENGTH wants when uploading it.
+ */
+template<class T>
 class Image {
 public:
+    static_assert(std::is_trivially_destructible_v<T>, "pixels are freed without running destructors");
+    
+    Image() = default;
+    
+    Image(const int32_t width, const int32_t height) {
+        resize(width, height);
+    }
+    
+    // throws away the contents
+    void resize(const int32_t width, const int32_t height) {
+        image_width = std::max(width, 0);
+        image_height = std::max(height, 0);
+        
+        const size_t elements_per_line = std::max(image_alignment / sizeof(T), size_t(1));
+        image_pitch = static_cast<int32_t>((image_width + elements_per_line - 1) / elements_per_line * elements_per_line);
+        
+        pixels.reset(static_cast<T*>(::operator new(size_bytes(), std::align_val_t(image_alignment))));
+        std::uninitialized_fill_n(pixels.get(), static_cast<size_t>(image_pitch) * image_height, T{});
+    }
+    
     void reset() {
-        array = {};
+        std::fill_n(pixels.get(), static_cast<size_t>(image_pitch) * image_height, T{});
     }
     
     T& get(const int32_t x, const int32_t y) {
-        return array[y * Width + x];
+        return pixels[static_cast<size_t>(y) * image_pitch + x];
     }
     
     T get(const int32_t x, const int32_t y) const {
-        return array[y * Width + x];
+        return pixels[static_cast<size_t>(y) * image_pitch + x];
+    }
+    
+    // start of a row, for walking a tile one row at a time
+    T* row(const int32_t y) {
+        return pixels.get() + static_cast<size_t>(y) * image_pitch;
+    }
+    
+    const T* row(const int32_t y) const {
+        return pixels.get() + static_cast<size_t>(y) * image_pitch;
+    }
+    
+    const T* data() const {
+        return pixels.get();
+    }
+    
+    int32_t width() const {
+        return image_width;
+    }
+    
+    int32_t height() const {
+        return image_height;
+    }
+    
+    int32_t pitch() const {
+        return image_pitch;
+    }
+
+private:
+    struct AlignedDelete {
+        void operator()(T* pointer) const {
+            ::operator delete(pointer, std::align_val_t(image_alignment));
+        }
+    };
+    
+    size_t size_bytes() const {
+        return std::max(static_cast<size_t>(image_pitch) * image_height * sizeof(T), sizeof(T));
     }
     
-    std::array<T, Width * Height> array = {};
+    std::unique_ptr<T[], AlignedDelete> pixels;
+    int32_t image_width = 0, image_height = 0, image_pitch = 0;
 };
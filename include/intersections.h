@@ -22,16 +22,14 @@ namespace intersections {
         return false;
     }
     
-    inline float ray_triangle(const Ray ray,
-                       const glm::vec3 v0,
-                       const glm::vec3 v1,
-                       const glm::vec3 v2,
-                       float& t,
-                       float& u,
-                       float& v) {
-        glm::vec3 e1 = v1 - v0;
-        glm::vec3 e2 = v2 - v0;
-        
+    // moller-trumbore against a triangle given as one vertex and the two edges leaving it
+    inline bool ray_triangle_edges(const Ray ray,
+                                   const glm::vec3 v0,
+                                   const glm::vec3 e1,
+                                   const glm::vec3 e2,
+                                   float& t,
+                                   float& u,
+                                   float& v) {
         glm::vec3 pvec = glm::cross(ray.direction, e2);
         float det = glm::dot(e1, pvec);
         
@@ -61,4 +59,14 @@ namespace intersections {
         
         return true;
     }
+    
+    inline float ray_triangle(const Ray ray,
+                       const glm::vec3 v0,
+                       const glm::vec3 v1,
+                       const glm::vec3 v2,
+                       float& t,
+                       float& u,
+                       float& v) {
+        return ray_triangle_edges(ray, v0, v1 - v0, v2 - v0, t, u, v);
+    }
 };
@@ -5,6 +5,9 @@
 constexpr int max_contained_types = 16;
 constexpr int max_octree_depth = 2;
 
+// every level of a traversal replaces one node with at most eight children
+constexpr int octree_stack_size = 7 * max_octree_depth + 1;
+
 constexpr auto child_pattern = {
     glm::vec3(+1, -1, -1),
     glm::vec3(+1, -1, +1),
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+#include "scene.h"
+
+// meshes built in code instead of loaded from a file, so benchmarks and reference renders don't depend on files on disk.
+// they come without acceleration structures, Scene::generate_acceleration builds those as for any other mesh
+
+// unit sphere around the origin with 2 * segments * (rings - 1) triangles and smooth normals
+std::shared_ptr<Mesh> make_sphere(const int segments, const int rings);
+
+// square of the given size in the xz plane, facing up
+std::shared_ptr<Mesh> make_plane(const float size);
+
+// count small triangles of random orientation scattered through the unit cube around the origin, the same for the same
+// seed
+std::shared_ptr<Mesh> make_triangle_soup(const int count, const uint64_t seed);
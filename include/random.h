@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+ PCG32 (pcg-random.org), small enough to keep one per pixel on the stack. Generators with the same seed but a different
+ stream never overlap, so every pixel can get its own sequence and a render looks the same no matter which thread
+ happened to draw it.
+ */
+struct Random {
+    explicit Random(const uint64_t seed, const uint64_t stream = 0) : increment((stream << 1u) | 1u) {
+        next();
+        state += seed;
+        next();
+    }
+    
+    uint32_t next() {
+        const uint64_t old_state = state;
+        state = old_state * 6364136223846793005ull + increment;
+        
+        const uint32_t xor_shifted = static_cast<uint32_t>(((old_state >> 18u) ^ old_state) >> 27u);
+        const uint32_t rotation = static_cast<uint32_t>(old_state >> 59u);
+        
+        return (xor_shifted >> rotation) | (xor_shifted << ((32 - rotation) & 31));
+    }
+    
+    // uniform in [0, 1), from the top 24 bits so every value is exactly representable
+    float uniform() {
+        return static_cast<float>(next() >> 8) * (1.0f / 16777216.0f);
+    }
+
+private:
+    uint64_t state = 0;
+    uint64_t increment;
+};
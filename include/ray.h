@@ -1,9 +1,24 @@
 #pragma once
 
+#include <array>
 #include <glm/glm.hpp>
 
 struct Ray {
-    Ray(const glm::vec3 origin, const glm::vec3 direction) : origin(origin), direction(direction) {}
+    Ray(const glm::vec3 origin, const glm::vec3 direction) : origin(origin), direction(direction) {
+        // cached for the slab tests, which would otherwise divide by the direction for every box
+        inverse_direction = 1.0f / direction;
+        
+        sign = {
+            inverse_direction.x < 0.0f,
+            inverse_direction.y < 0.0f,
+            inverse_direction.z < 0.0f
+        };
+    }
 
     glm::vec3 origin, direction;
+    
+    glm::vec3 inverse_direction;
+    
+    // 1 where the direction is negative, picks which side of a box is the near one on each axis
+    std::array<int, 3> sign;
 };
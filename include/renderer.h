@@ -0,0 +1,160 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <glm/glm.hpp>
+
+#include "camera.h"
+#include "image.h"
+#include "scene.h"
+#include "stats.h"
+#include "thread_pool.h"
+
+enum class DisplayMode {
+    Combined,
+    Direct,
+    Indirect,
+    Reflect,
+    
+    // false color heatmaps of what each sample of a pixel cost, see heatmap_color
+    RenderTime,
+    NodesVisited,
+    TrianglesTested
+};
+
+inline bool is_heatmap(const DisplayMode display_mode) {
+    return display_mode == DisplayMode::RenderTime || display_mode == DisplayMode::NodesVisited || display_mode == DisplayMode::TrianglesTested;
+}
+
+struct RenderSettings {
+    Accelerator accelerator = Accelerator::BVH;
+    Integrator integrator = Integrator::Recursive;
+    DisplayMode display_mode = DisplayMode::Combined;
+    
+    // taken by every pixel in one pass
+    int samples_per_pixel = 1;
+    int seed = 0;
+    
+    // diffuse bounces cast_scene branches into at every hit
+    int indirect_samples = 4;
+    
+    // longest path trace_path follows. deeper than cast_scene's max_depth by default, since a path doesn't branch and
+    // every bounce loses energy, so the extra bounces only add the light that max_depth cuts off. at max_bounces ==
+    // max_depth both integrators make the same estimate
+    int max_bounces = 8;
+    
+    // adaptive sampling stops giving samples to pixels whose mean is known to within noise_threshold of itself, or
+    // that reached max_samples
+    bool adaptive = false;
+    float noise_threshold = 0.02f;
+    int max_samples = 1024;
+};
+
+// whether samples taken with either settings estimate the same thing, so they can be averaged into one image
+bool same_estimate(const RenderSettings& a, const RenderSettings& b);
+
+/*
+ Renders a scene into an accumulation buffer, one pass of tiles at a time on a thread pool. Passes only add samples, so
+ colors converges towards the final image the more of them are run. Nothing in here needs a window, the UI and the
+ headless renderer share it.
+ */
+class Renderer {
+public:
+    Renderer(const Scene& scene, ThreadPool& pool, const int32_t width = 256, const int32_t height = 256) : scene(scene), pool(pool) {
+        camera.look_at(glm::vec3(4), glm::vec3(0));
+        resize(width, height);
+    }
+    
+    // waits for the current pass and clears the image
+    void resize(const int32_t width, const int32_t height);
+    
+    int32_t width() const {
+        return colors.width();
+    }
+    
+    int32_t height() const {
+        return colors.height();
+    }
+    
+    // throws away the previous image and whatever was still queued for it, then starts the first pass
+    void start();
+    
+    // queues samples_per_pixel more samples for every pixel, on top of what is already accumulated. starts over instead if
+    // settings changed what is being estimated since the last pass. returns right away, the pass is done once the pool
+    // is idle
+    void render_pass();
+    
+    int passes() const {
+        return num_passes;
+    }
+    
+    // true once an adaptive render has nothing left to sample, and settings haven't changed what it should show since
+    bool finished() const {
+        return pass_settings.adaptive && num_passes > 0 && pixels_sampled == 0 && same_estimate(settings, pass_settings);
+    }
+    
+    // share of pixels the last pass didn't have to sample anymore
+    float converged_fraction() const {
+        return 1.0f - pixels_sampled / static_cast<float>(width() * height());
+    }
+    
+    // rays and traversal work of the last pass, only complete once the pool is idle again
+    RenderStats pass_stats() const {
+        std::lock_guard lock(stats_mutex);
+        return last_pass_stats;
+    }
+    
+    // the same over every pass since the last start
+    RenderStats total_stats() const {
+        std::lock_guard lock(stats_mutex);
+        return accumulated_stats;
+    }
+    
+    bool write_png(const std::string& path) const;
+    
+    // read once at the start of every pass, so it can be changed while one is running
+    RenderSettings settings;
+    Camera camera;
+    
+    Image<glm::vec4> colors;
+    
+    // set whenever colors changes, for the UI to know when to upload it again
+    std::atomic<bool> image_dirty = false;
+
+private:
+    bool converged(const int32_t x, const int32_t y) const;
+    bool calculate_pixel(const int32_t x, const int32_t y, const int pass);
+    void run_tile(const int32_t from_x, const int32_t to_width, const int32_t from_y, const int32_t to_height, const int pass);
+    void calculate_tile(const int32_t from_x, const int32_t to_width, const int32_t from_y, const int32_t to_height, const int pass);
+    
+    const Scene& scene;
+    ThreadPool& pool;
+    
+    // sum of every sample since the last start in rgb and how many there were in alpha, colors shows the mean of it
+    Image<glm::vec4> accumulation;
+    
+    // sum of the squared luminance of every sample, next to accumulation, for the variance
+    Image<float> luminance_squares;
+    
+    // what the heatmap in pass_settings.display_mode measures, summed over every sample in x, and how many samples were
+    // measured in y. kept apart from accumulation, since costs are only measured while a heatmap is shown
+    Image<glm::vec2> pixel_costs;
+    
+    // settings as of the current pass, which is all the tiles read. pixel_costs starts over whenever the display mode
+    // switches into a heatmap
+    RenderSettings pass_settings;
+    
+    int num_passes = 0;
+    
+    // pixels that still took samples in the last pass, none means the whole image converged
+    std::atomic<int> pixels_sampled = 0;
+    
+    // every job counts into thread_stats and merges it in here once, when it's done
+    mutable std::mutex stats_mutex;
+    RenderStats last_pass_stats, accumulated_stats;
+};
+
+// the sphere over a red plane the ui's File > Load sets up, built on pool if there is one. false if sphere.obj or
+// plane.obj couldn't be read from the working directory, in which case the scene is left as it was
+bool load_example_scene(Scene& scene, ThreadPool* pool = nullptr);
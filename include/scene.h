@@ -3,8 +3,13 @@
 #include <optional>
 #include <glm/glm.hpp>
 #include <array>
+#include <chrono>
+#include <functional>
 #include <iostream>
-#include <random>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
 
 #include <tiny_obj_loader.h>
 
@@ -12,35 +17,82 @@
 #include "intersections.h"
 #include "lighting.h"
 #include "octree.h"
+#include "bvh.h"
+#include "wide_bvh.h"
+#include "triangles.h"
+#include "random.h"
+#include "thread_pool.h"
+#include "trace.h"
 
 constexpr glm::vec3 light_position = glm::vec3(5);
 constexpr float light_bias = 0.01f;
 constexpr int max_depth = 2;
-inline int num_indirect_samples = 4;
+
+// paths trace_path follows past this many bounces are ended at random
+constexpr int russian_roulette_depth = 3;
+
+// how much of the light arriving at a surface leaves it along the mirror and the diffuse lobe, the diffuse one tinted by
+// the object's color. they add up to at most one, so light only ever gets weaker from bounce to bounce
+constexpr float mirror_albedo = 0.5f;
+constexpr float diffuse_albedo = 0.5f;
+
+enum class Accelerator {
+    None,
+    Octree,
+    BVH,
+    WideBVH
+};
+
+enum class Integrator {
+    Recursive,
+    Path
+};
 
 struct TriangleBox {
-    uint64_t vertice_index = 0;
-    tinyobj::mesh_t* mesh;
+    // index into the owning mesh's TriangleBuffer
+    uint32_t triangle_index = 0;
     AABB extent;
 };
 
-struct Object;
+struct ObjectBox {
+    // index into Scene::objects
+    uint32_t object_index = 0;
+    AABB extent;
+};
 
-glm::vec3 fetch_position(const Object& object, const tinyobj::mesh_t& mesh, const int32_t index, const int32_t vertex);
-glm::vec3 fetch_normal(const Object& object, const tinyobj::mesh_t& mesh, const int32_t index, const int32_t vertex);
+struct Mesh;
 
-struct Object {
-    glm::vec3 position = glm::vec3(0);
-    glm::vec3 color = glm::vec3(1);
-    
+glm::vec3 fetch_position(const Mesh& mesh_data, const tinyobj::mesh_t& mesh, const int32_t index, const int32_t vertex);
+glm::vec3 fetch_normal(const Mesh& mesh_data, const tinyobj::mesh_t& mesh, const int32_t index, const int32_t vertex);
+
+/*
+ Geometry loaded from one file, along with its acceleration structures. These are all in object space, so any number
+ of objects can share the same mesh.
+ */
+struct Mesh {
     tinyobj::attrib_t attrib;
     std::vector<tinyobj::shape_t> shapes;
     std::vector<tinyobj::material_t> materials;
     
+    TriangleBuffer triangles;
+    
     std::unique_ptr<Octree<TriangleBox>> octree;
-
-    void create_octree() {
-        octree = std::make_unique<Octree<TriangleBox>>(glm::vec3(-2), glm::vec3(2));
+    std::unique_ptr<BVH<TriangleBox>> bvh;
+    std::unique_ptr<WideBVH> wide_bvh;
+    
+    // before compile_triangles, the number of triangles it's going to make
+    size_t num_faces() const {
+        size_t count = 0;
+        for(auto& shape : shapes)
+            count += shape.mesh.num_face_vertices.size();
+        
+        return count;
+    }
+    
+    void compile_triangles() {
+        TraceScope scope("compile_triangles");
+        
+        triangles = {};
         
         for(auto& shape : shapes) {
             for(size_t i = 0; i < shape.mesh.num_face_vertices.size(); i++) {
@@ -48,49 +100,202 @@ struct Object {
                 const glm::vec3 v1 = fetch_position(*this, shape.mesh, i, 1);
                 const glm::vec3 v2 = fetch_position(*this, shape.mesh, i, 2);
                 
-                AABB extent;
-                extent.min = glm::min(v0, v1);
-                extent.min = glm::min(extent.min, v2);
-                
-                extent.max = glm::max(v0, v1);
-                extent.max = glm::max(extent.max, v2);
-                
-                TriangleBox box = {};
-                box.vertice_index = i;
-                box.extent = extent;
-                box.mesh = &shape.mesh;
-                
-                octree->add(box, box.extent);
+                triangles.add(v0, v1, v2, shape.mesh, i);
             }
         }
+        
+        triangles.finish();
+    }
+    
+    std::vector<TriangleBox> triangle_boxes() const {
+        std::vector<TriangleBox> boxes(triangles.size());
+        for(size_t i = 0; i < triangles.size(); i++) {
+            boxes[i].triangle_index = i;
+            boxes[i].extent = triangles.extent(i);
+        }
+        
+        return boxes;
+    }
+
+    void create_octree() {
+        TraceScope scope("create_octree");
+        
+        // octree nodes are split as cubes, so grow the mesh bounds into one. every triangle has to be inside the root,
+        // otherwise the traversal can't tell how far away its hits can be
+        std::vector<TriangleBox> boxes = triangle_boxes();
+        
+        AABB bounds = AABB::empty();
+        for(auto& box : boxes)
+            bounds.grow(box.extent);
+        
+        const glm::vec3 extent = bounds.max - bounds.min;
+        const float half_size = std::max(std::max(extent.x, extent.y), extent.z) / 2.0f + epsilon;
+        
+        octree = std::make_unique<Octree<TriangleBox>>(bounds.center() - glm::vec3(half_size), bounds.center() + glm::vec3(half_size));
+        
+        for(auto& box : boxes)
+            octree->add(box, box.extent);
+    }
+    
+    // also sorts the triangle buffer into leaf order, so every leaf covers the same range in both. a pool spreads the
+    // bvh build over its workers
+    void create_bvh(ThreadPool* pool = nullptr) {
+        TraceScope scope("create_bvh");
+        
+        bvh = std::make_unique<BVH<TriangleBox>>(triangle_boxes(), triangle_simd_width, pool);
+        
+        std::vector<uint32_t> order(bvh->primitives.size());
+        for(size_t i = 0; i < order.size(); i++) {
+            order[i] = bvh->primitives[i].triangle_index;
+            bvh->primitives[i].triangle_index = i;
+        }
+        
+        triangles = triangles.reordered(order);
+        
+        wide_bvh = std::make_unique<WideBVH>(*bvh);
+    }
+    
+    void generate_acceleration(ThreadPool* pool = nullptr) {
+        compile_triangles();
+        create_bvh(pool);
+        create_octree();
+    }
+    
+    AABB extent() const {
+        return bvh->nodes.empty() ? AABB::empty() : bvh->nodes[0].extent;
+    }
+};
+
+// an instance of a mesh placed in the scene
+struct Object {
+    std::shared_ptr<Mesh> mesh;
+    
+    glm::mat4 transform = glm::mat4(1.0f);
+    glm::vec3 color = glm::vec3(1);
+    
+    // derived from transform by update_transform()
+    glm::mat4 inverse_transform = glm::mat4(1.0f);
+    glm::mat3 normal_matrix = glm::mat3(1.0f);
+    
+    void update_transform() {
+        inverse_transform = glm::inverse(transform);
+        normal_matrix = glm::transpose(glm::mat3(inverse_transform));
+    }
+    
+    // the direction isn't renormalized, so distances along the ray stay the same in both spaces
+    Ray to_object_space(const Ray& ray) const {
+        return Ray(glm::vec3(inverse_transform * glm::vec4(ray.origin, 1.0f)), glm::vec3(inverse_transform * glm::vec4(ray.direction, 0.0f)));
+    }
+    
+    AABB extent() const {
+        const AABB local = mesh->extent();
+        
+        AABB world = AABB::empty();
+        for(int i = 0; i < 8; i++) {
+            const glm::vec3 corner((i & 1) ? local.max.x : local.min.x,
+                                   (i & 2) ? local.max.y : local.min.y,
+                                   (i & 4) ? local.max.z : local.min.z);
+            world.grow(glm::vec3(transform * glm::vec4(corner, 1.0f)));
+        }
+        
+        return world;
     }
 };
 
 struct Scene {
     std::vector<std::unique_ptr<Object>> objects;
     
-    std::random_device rd;
-    std::mt19937 gen;
-    std::uniform_real_distribution<> dis;
+    // meshes by the path they were loaded from, so loading the same file again only adds another instance
+    std::map<std::string, std::shared_ptr<Mesh>> meshes;
     
-    Scene() : gen(rd()), dis(0.0, 1.0) {}
+    // bvh over the bounds of every object, whose leaves lead to the per-mesh acceleration structures
+    std::unique_ptr<BVH<ObjectBox>> top_level;
     
-    float distribution() {
-        return dis(gen);
+    // null if the file couldn't be read, in which case the scene is left as it was
+    Object* load_from_file(const std::string_view path) {
+        const std::string key(path);
+        
+        auto& mesh = meshes[key];
+        if(!mesh) {
+            TraceScope scope("load_from_file");
+            
+            mesh = std::make_shared<Mesh>();
+            
+            if(!tinyobj::LoadObj(&mesh->attrib, &mesh->shapes, &mesh->materials, nullptr, key.c_str())) {
+                meshes.erase(key);
+                return nullptr;
+            }
+        }
+        
+        auto o = std::make_unique<Object>();
+        o->mesh = mesh;
+      
+        return objects.emplace_back(std::move(o)).get();
     }
     
-    Object& load_from_file(const std::string_view path) {
+    // adds an instance of a mesh that wasn't loaded from a file, name stands in for the path. null if name already
+    // belongs to another mesh, which would otherwise lose its entry and never get built
+    Object* add_mesh(const std::string_view name, std::shared_ptr<Mesh> mesh) {
+        auto& entry = meshes[std::string(name)];
+        if(entry && entry != mesh)
+            return nullptr;
+        
+        entry = mesh;
+        
         auto o = std::make_unique<Object>();
+        o->mesh = std::move(mesh);
         
-        tinyobj::LoadObj(&o->attrib, &o->shapes, &o->materials, nullptr, path.data());
-      
-        return *objects.emplace_back(std::move(o));
+        return objects.emplace_back(std::move(o)).get();
     }
     
-    void generate_acceleration() {
-        for(auto& object : objects) {
-            object->create_octree();
+    // wall time of the last generate_acceleration
+    double build_seconds = 0.0;
+    
+    // builds whatever meshes don't have acceleration structures yet. with a pool, which has to be idle and can't be
+    // the one calling this, small meshes are built whole one per worker, while large ones get every worker to
+    // themselves one after another
+    void generate_acceleration(ThreadPool* pool = nullptr) {
+        TraceScope scope("generate_acceleration");
+        const auto start = std::chrono::steady_clock::now();
+        
+        std::vector<Mesh*> large_meshes;
+        
+        for(auto& [path, mesh] : meshes) {
+            if(mesh->bvh)
+                continue;
+            
+            if(pool == nullptr)
+                mesh->generate_acceleration();
+            else if(mesh->num_faces() < bvh_parallel_min_primitives)
+                pool->submit([mesh = mesh.get()] { mesh->generate_acceleration(); });
+            else
+                large_meshes.push_back(mesh.get());
+        }
+        
+        if(pool != nullptr) {
+            for(Mesh* mesh : large_meshes)
+                mesh->generate_acceleration(pool);
+            
+            pool->wait();
         }
+        
+        std::vector<ObjectBox> boxes;
+        for(size_t i = 0; i < objects.size(); i++) {
+            objects[i]->update_transform();
+            
+            if(objects[i]->mesh->bvh->nodes.empty())
+                continue;
+            
+            ObjectBox box = {};
+            box.object_index = i;
+            box.extent = objects[i]->extent();
+            
+            boxes.push_back(box);
+        }
+        
+        top_level = std::make_unique<BVH<ObjectBox>>(std::move(boxes), 1, pool);
+        
+        build_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
     }
 };
 
@@ -99,14 +304,42 @@ struct HitResult {
     const Object* object = nullptr;
 };
 
-std::optional<HitResult> test_mesh(const Ray ray, const Object& object, const tinyobj::mesh_t& mesh, float& tClosest);
 std::optional<HitResult> test_scene(const Ray ray, const Scene& scene);
 std::optional<HitResult> test_scene_octree(const Ray ray, const Scene& scene);
+std::optional<HitResult> test_scene_bvh(const Ray ray, const Scene& scene);
+std::optional<HitResult> test_scene_wide_bvh(const Ray ray, const Scene& scene);
+
+// any-hit queries for shadow rays, true as soon as anything is hit between the origin and t_max
+bool occluded_scene(const Ray ray, const Scene& scene, const float t_max);
+bool occluded_scene_octree(const Ray ray, const Scene& scene, const float t_max);
+bool occluded_scene_bvh(const Ray ray, const Scene& scene, const float t_max);
+bool occluded_scene_wide_bvh(const Ray ray, const Scene& scene, const float t_max);
+
+// light reaching the hit straight from the point light, tinted by the object's color
+glm::vec3 direct_light(const HitResult& hit, const Scene& scene, const std::function<decltype(occluded_scene)>& occlusion_func);
+
+// start secondary rays slightly off the surface so they don't hit it again
+glm::vec3 bounce_origin(const HitResult& hit);
+
+// map two uniform numbers to a direction around +z. cosine_hemisphere picks a point uniformly on the unit disk and
+// projects it up onto the hemisphere, for a probability density of cos(theta) / pi, uniform_hemisphere has a density of
+// 1 / (2 pi)
+glm::vec3 cosine_hemisphere(const float u1, const float u2);
+glm::vec3 uniform_hemisphere(const float u1, const float u2);
+
+// rotates a direction around +z into the same direction around normal
+glm::vec3 around_normal(const glm::vec3& normal, const glm::vec3& direction);
 
 struct SceneResult {
     HitResult hit;
     glm::vec3 direct, indirect, reflect, combined;
 };
 
-std::optional<SceneResult> cast_scene(const Ray ray, Scene& scene, const bool use_bvh, const int depth = 0);
+// random is only touched by the calling thread, give every pixel its own to keep renders deterministic. every hit
+// branches into a mirror bounce and indirect_samples diffuse ones, up to max_depth
+std::optional<SceneResult> cast_scene(const Ray ray, const Scene& scene, Random& random, const Accelerator accelerator, const int indirect_samples, const int depth = 0);
+
+// one sample of the same estimate cast_scene makes, but following a single path of at most max_bounces bounces instead
+// of branching at every hit
+std::optional<SceneResult> trace_path(const Ray ray, const Scene& scene, Random& random, const Accelerator accelerator, const int max_bounces);
 
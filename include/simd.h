@@ -0,0 +1,11 @@
+#pragma once
+
+// picks the widest instruction set the compiler targets, RAYTRACER_NO_SIMD forces the scalar code paths everywhere
+#if !defined(RAYTRACER_NO_SIMD) && defined(__AVX2__)
+#include <immintrin.h>
+#define RAYTRACER_AVX2
+#define RAYTRACER_SSE2
+#elif !defined(RAYTRACER_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+#include <emmintrin.h>
+#define RAYTRACER_SSE2
+#endif
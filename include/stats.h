@@ -0,0 +1,78 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+enum class RayType {
+    Primary,
+    Shadow,
+    Reflection,
+    Indirect
+};
+
+constexpr int num_ray_types = 4;
+
+constexpr std::array ray_type_strings = {
+    "Primary",
+    "Shadow",
+    "Reflection",
+    "Indirect"
+};
+
+// what went into rendering something, summed up per thread and merged once a job is done
+struct RenderStats {
+    std::array<uint64_t, num_ray_types> rays = {};
+    
+    // acceleration structure nodes entered and triangles tested, over every kind of ray
+    uint64_t nodes_visited = 0;
+    uint64_t triangles_tested = 0;
+    
+    void count_ray(const RayType type) {
+        rays[static_cast<int>(type)]++;
+    }
+    
+    uint64_t total_rays() const {
+        uint64_t total = 0;
+        for(const uint64_t count : rays)
+            total += count;
+        
+        return total;
+    }
+    
+    RenderStats& operator+=(const RenderStats& other) {
+        for(int i = 0; i < num_ray_types; i++)
+            rays[i] += other.rays[i];
+        
+        nodes_visited += other.nodes_visited;
+        triangles_tested += other.triangles_tested;
+        
+        return *this;
+    }
+    
+    // a few lines of rays per second by type and average work per ray, for the ui and the headless renderer
+    std::string summary(const double seconds) const {
+        std::string text;
+        char line[128];
+        
+        const double total = static_cast<double>(total_rays());
+        const double per_second = seconds > 0.0 ? 1.0 / seconds : 0.0;
+        
+        std::snprintf(line, sizeof(line), "%.1f ms, %.2f Mrays/s\n", seconds * 1000.0, total * per_second / 1e6);
+        text += line;
+        
+        for(int i = 0; i < num_ray_types; i++) {
+            std::snprintf(line, sizeof(line), "  %-10s %12llu rays, %.2f Mrays/s\n", ray_type_strings[i], static_cast<unsigned long long>(rays[i]), rays[i] * per_second / 1e6);
+            text += line;
+        }
+        
+        std::snprintf(line, sizeof(line), "  %.1f nodes and %.1f triangles per ray", total > 0.0 ? nodes_visited / total : 0.0, total > 0.0 ? triangles_tested / total : 0.0);
+        text += line;
+        
+        return text;
+    }
+};
+
+// counters of the calling thread, so counting never touches memory another thread writes to
+inline thread_local RenderStats thread_stats;
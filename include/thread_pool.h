@@ -0,0 +1,285 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ Fixed set of worker threads that live as long as the pool, so rendering a frame doesn't pay for creating a thread per
+ tile or run more threads than there are cores. Every worker has its own queue which it works through back to front,
+ and once that is empty it steals from the front of the others'. Jobs can check starving() to find out whether
+ splitting themselves up would give an idle worker something to do.
+ */
+class ThreadPool {
+public:
+    using Job = std::function<void()>;
+    using Clock = std::chrono::steady_clock;
+    
+    // timings of one batch, from the first job being submitted to an idle pool until the last one finished
+    struct Stats {
+        Clock::duration wall = {};
+        
+        // time spent running jobs, summed over all workers
+        Clock::duration busy = {};
+        
+        int threads = 0;
+        
+        // share of the available thread time nobody had anything to do, which is mostly the tail of a frame
+        double idle_fraction() const {
+            const double available = std::chrono::duration<double>(wall).count() * threads;
+            
+            return available > 0.0 ? std::max(1.0 - std::chrono::duration<double>(busy).count() / available, 0.0) : 0.0;
+        }
+    };
+    
+    // zero means one thread per hardware thread
+    explicit ThreadPool(const int num_threads = 0) {
+        start(num_threads);
+    }
+    
+    ~ThreadPool() {
+        stop();
+    }
+    
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    
+    static int default_thread_count() {
+        return std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+    }
+    
+    int thread_count() const {
+        return static_cast<int>(workers.size());
+    }
+    
+    // finishes the jobs already running, then restarts with a different number of threads. queued jobs are kept
+    void resize(const int num_threads) {
+        std::vector<Job> leftover = stop();
+        start(num_threads);
+        
+        for(size_t i = 0; i < leftover.size(); i++)
+            push(i % workers.size(), std::move(leftover[i]));
+        
+        wake_workers(leftover.size());
+    }
+    
+    // from inside a job the new one goes to the back of the current worker's own queue, so it runs next unless
+    // someone steals it. otherwise the queues are filled round robin
+    void submit(Job job) {
+        {
+            std::lock_guard lock(mutex);
+            if(outstanding.load() == 0) {
+                batch_start = Clock::now();
+                batch_busy = 0;
+            }
+            
+            outstanding++;
+        }
+        
+        const size_t index = current_pool == this ? current_worker : next_worker++ % workers.size();
+        push(index, std::move(job));
+        
+        wake_workers(1);
+    }
+    
+    // true when a worker ran out of jobs and there is nothing left to steal
+    bool starving() const {
+        return idle_workers.load() > 0 && queued.load() == 0;
+    }
+    
+    // drops every job that hasn't been picked up by a worker yet
+    void cancel() {
+        int removed = 0;
+        for(auto& worker : workers) {
+            std::lock_guard lock(worker->mutex);
+            removed += static_cast<int>(worker->jobs.size());
+            worker->jobs.clear();
+        }
+        
+        queued -= removed;
+        finish(removed);
+    }
+    
+    // blocks until every submitted job has finished
+    void wait() {
+        std::unique_lock lock(mutex);
+        all_done.wait(lock, [this] { return outstanding.load() == 0; });
+    }
+    
+    bool idle() const {
+        return outstanding.load() == 0;
+    }
+    
+    // timings of the last batch that ran to completion
+    Stats last_stats() {
+        std::lock_guard lock(mutex);
+        return stats;
+    }
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+    
+    void start(const int num_threads) {
+        stopping = false;
+        
+        const int count = num_threads > 0 ? num_threads : default_thread_count();
+        for(int i = 0; i < count; i++)
+            workers.push_back(std::make_unique<Worker>());
+        
+        for(int i = 0; i < count; i++)
+            threads.emplace_back([this, i] { work(i); });
+    }
+    
+    // returns the jobs nobody got to
+    std::vector<Job> stop() {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        
+        job_available.notify_all();
+        
+        for(auto& thread : threads)
+            thread.join();
+        
+        std::vector<Job> leftover;
+        for(auto& worker : workers) {
+            for(auto& job : worker->jobs)
+                leftover.push_back(std::move(job));
+        }
+        
+        queued -= static_cast<int>(leftover.size());
+        
+        threads.clear();
+        workers.clear();
+        
+        return leftover;
+    }
+    
+    void push(const size_t index, Job job) {
+        {
+            std::lock_guard lock(workers[index]->mutex);
+            workers[index]->jobs.push_back(std::move(job));
+        }
+        
+        queued++;
+    }
+    
+    void wake_workers(const size_t count) {
+        // taking the lock makes sure a worker can't check for jobs and go to sleep in between
+        std::lock_guard lock(mutex);
+        
+        if(count == 1)
+            job_available.notify_one();
+        else if(count > 1)
+            job_available.notify_all();
+    }
+    
+    // own queue from the back, the others from the front, starting with the next worker along
+    bool take(const size_t index, Job& job) {
+        for(size_t i = 0; i < workers.size(); i++) {
+            Worker& worker = *workers[(index + i) % workers.size()];
+            
+            std::lock_guard lock(worker.mutex);
+            if(worker.jobs.empty())
+                continue;
+            
+            if(i == 0) {
+                job = std::move(worker.jobs.back());
+                worker.jobs.pop_back();
+            } else {
+                job = std::move(worker.jobs.front());
+                worker.jobs.pop_front();
+            }
+            
+            queued--;
+            return true;
+        }
+        
+        return false;
+    }
+    
+    void finish(const int count) {
+        if(count == 0)
+            return;
+        
+        // anything but the last jobs of a batch is counted without the lock
+        int current = outstanding.load();
+        while(current > count) {
+            if(outstanding.compare_exchange_weak(current, current - count))
+                return;
+        }
+        
+        // the last ones only count as done together with recording the stats, so wait() and idle() can't see the batch
+        // end before last_stats() has it. submit() may have started more jobs in the meantime, then the batch goes on
+        std::lock_guard lock(mutex);
+        if(outstanding.fetch_sub(count) == count) {
+            stats.wall = Clock::now() - batch_start;
+            stats.busy = Clock::duration(batch_busy.load());
+            stats.threads = thread_count();
+            
+            all_done.notify_all();
+        }
+    }
+    
+    void work(const size_t index) {
+        current_pool = this;
+        current_worker = index;
+        
+        while(!stopping) {
+            Job job;
+            if(!take(index, job)) {
+                std::unique_lock lock(mutex);
+                
+                idle_workers++;
+                job_available.wait(lock, [this] { return stopping || queued.load() > 0; });
+                idle_workers--;
+                
+                if(stopping)
+                    return;
+                
+                continue;
+            }
+            
+            const auto job_start = Clock::now();
+            job();
+            batch_busy += (Clock::now() - job_start).count();
+            
+            finish(1);
+        }
+    }
+    
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+    
+    // guards sleeping and waking, and the batch timings
+    std::mutex mutex;
+    std::condition_variable job_available, all_done;
+    std::atomic<bool> stopping = false;
+    
+    // jobs sitting in any of the queues
+    std::atomic<int> queued = 0;
+    
+    // jobs submitted but not yet finished, queued or running
+    std::atomic<int> outstanding = 0;
+    
+    std::atomic<int> idle_workers = 0;
+    std::atomic<size_t> next_worker = 0;
+    
+    Clock::time_point batch_start;
+    std::atomic<Clock::rep> batch_busy = 0;
+    Stats stats;
+    
+    static inline thread_local ThreadPool* current_pool = nullptr;
+    static inline thread_local size_t current_worker = 0;
+};
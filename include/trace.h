@@ -0,0 +1,155 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// numbers an event can carry along, shown in the trace viewer when it's selected
+constexpr int max_trace_args = 6;
+
+struct TraceEvent {
+    // names have to be string literals or otherwise outlive the tracer, they're only copied as pointers
+    const char* name = nullptr;
+    int64_t start_us = 0, duration_us = 0;
+    
+    std::array<std::pair<const char*, int64_t>, max_trace_args> args = {};
+    int num_args = 0;
+};
+
+/*
+ Records timed events per thread while enabled and writes them as a Chrome trace (chrome://tracing, ui.perfetto.dev),
+ one track per thread. Every thread appends to a buffer of its own, which only ever waits while write() reads it. While
+ disabled a TraceScope costs a single atomic load.
+ */
+class Tracer {
+public:
+    using Clock = std::chrono::steady_clock;
+    
+    // throws away whatever was recorded before
+    void start() {
+        std::lock_guard lock(mutex);
+        
+        for(auto& buffer : buffers) {
+            std::lock_guard buffer_lock(buffer->mutex);
+            buffer->events.clear();
+        }
+        
+        epoch = Clock::now().time_since_epoch().count();
+        recording = true;
+    }
+    
+    void stop() {
+        recording = false;
+    }
+    
+    bool enabled() const {
+        return recording.load(std::memory_order_relaxed);
+    }
+    
+    int64_t now_us() const {
+        return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now().time_since_epoch() - Clock::duration(epoch.load(std::memory_order_relaxed))).count();
+    }
+    
+    void record(const TraceEvent& event) {
+        ThreadBuffer& buffer = thread_buffer();
+        
+        std::lock_guard lock(buffer.mutex);
+        buffer.events.push_back(event);
+    }
+    
+    // can be called while events are still coming in, those just may or may not make it into the file
+    bool write(const std::string_view path) {
+        std::FILE* file = std::fopen(path.data(), "w");
+        if(file == nullptr)
+            return false;
+        
+        std::lock_guard lock(mutex);
+        
+        std::fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        
+        bool first = true;
+        for(size_t thread = 0; thread < buffers.size(); thread++) {
+            std::lock_guard buffer_lock(buffers[thread]->mutex);
+            
+            std::fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"args\":{\"name\":\"thread %zu\"}}", first ? "" : ",\n", thread, thread);
+            first = false;
+            
+            for(const TraceEvent& event : buffers[thread]->events) {
+                std::fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%zu,\"ts\":%lld,\"dur\":%lld,\"args\":{", event.name, thread, static_cast<long long>(event.start_us), static_cast<long long>(event.duration_us));
+                
+                for(int i = 0; i < event.num_args; i++)
+                    std::fprintf(file, "%s\"%s\":%lld", i > 0 ? "," : "", event.args[i].first, static_cast<long long>(event.args[i].second));
+                
+                std::fprintf(file, "}}");
+            }
+        }
+        
+        std::fprintf(file, "\n]}\n");
+        
+        return std::fclose(file) == 0;
+    }
+
+private:
+    struct ThreadBuffer {
+        std::mutex mutex;
+        std::vector<TraceEvent> events;
+    };
+    
+    // buffers outlive their threads, so a pool that was resized mid recording still shows up
+    ThreadBuffer& thread_buffer() {
+        thread_local ThreadBuffer* buffer = nullptr;
+        
+        if(buffer == nullptr) {
+            std::lock_guard lock(mutex);
+            buffer = buffers.emplace_back(std::make_unique<ThreadBuffer>()).get();
+        }
+        
+        return *buffer;
+    }
+    
+    std::atomic<bool> recording = false;
+    std::atomic<Clock::rep> epoch = Clock::now().time_since_epoch().count();
+    
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+};
+
+inline Tracer tracer;
+
+// records the time from its construction to the end of the enclosing scope as one event, if the tracer was enabled
+// when it was constructed
+class TraceScope {
+public:
+    explicit TraceScope(const char* name) {
+        if(tracer.enabled()) {
+            event.name = name;
+            event.start_us = tracer.now_us();
+        }
+    }
+    
+    ~TraceScope() {
+        if(event.name != nullptr) {
+            event.duration_us = tracer.now_us() - event.start_us;
+            tracer.record(event);
+        }
+    }
+    
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+    
+    // ignored past max_trace_args
+    void arg(const char* name, const int64_t value) {
+        if(event.name != nullptr && event.num_args < max_trace_args)
+            event.args[event.num_args++] = {name, value};
+    }
+
+private:
+    TraceEvent event;
+};
@@ -0,0 +1,314 @@
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include <tiny_obj_loader.h>
+
+#include "simd.h"
+#include "ray.h"
+#include "aabb.h"
+#include "intersections.h"
+
+// how many triangles the intersection kernel tests at once
+#if defined(RAYTRACER_AVX2)
+constexpr int triangle_simd_width = 8;
+#elif defined(RAYTRACER_SSE2)
+constexpr int triangle_simd_width = 4;
+#else
+constexpr int triangle_simd_width = 1;
+#endif
+
+struct TriangleHit {
+    uint32_t index = 0;
+    float t = 0.0f, u = 0.0f, v = 0.0f;
+};
+
+/*
+ A mesh's triangles in object space, shared by every object that instances the mesh, which transform rays into object
+ space before testing against them. Stored as a structure of arrays so the intersection loops stream through contiguous
+ memory instead of chasing tinyobj indices. The two edges are stored instead of the other two
+ vertices, since those are what the intersection test actually needs.
+ */
+struct TriangleBuffer {
+    std::vector<float> v0_x, v0_y, v0_z;
+    std::vector<float> e1_x, e1_y, e1_z;
+    std::vector<float> e2_x, e2_y, e2_z;
+    
+    // where each triangle came from, normals are still fetched from the mesh once a hit is found
+    std::vector<const tinyobj::mesh_t*> meshes;
+    std::vector<uint32_t> faces;
+    
+    size_t size() const {
+        return faces.size();
+    }
+    
+    // the vertex and edge arrays are padded with degenerate triangles, so the simd kernel can always load a full
+    // register past the end of a range. has to be called after the last add()
+    void finish() {
+        for(auto array : {&v0_x, &v0_y, &v0_z, &e1_x, &e1_y, &e1_z, &e2_x, &e2_y, &e2_z}) {
+            array->resize(size());
+            array->resize(size() + triangle_simd_width - 1, 0.0f);
+        }
+    }
+    
+    void add(const glm::vec3 v0, const glm::vec3 v1, const glm::vec3 v2, const tinyobj::mesh_t& mesh, const uint32_t face) {
+        const glm::vec3 e1 = v1 - v0;
+        const glm::vec3 e2 = v2 - v0;
+        
+        v0_x.push_back(v0.x);
+        v0_y.push_back(v0.y);
+        v0_z.push_back(v0.z);
+        
+        e1_x.push_back(e1.x);
+        e1_y.push_back(e1.y);
+        e1_z.push_back(e1.z);
+        
+        e2_x.push_back(e2.x);
+        e2_y.push_back(e2.y);
+        e2_z.push_back(e2.z);
+        
+        meshes.push_back(&mesh);
+        faces.push_back(face);
+    }
+    
+    glm::vec3 vertex(const size_t i) const {
+        return glm::vec3(v0_x[i], v0_y[i], v0_z[i]);
+    }
+    
+    glm::vec3 edge1(const size_t i) const {
+        return glm::vec3(e1_x[i], e1_y[i], e1_z[i]);
+    }
+    
+    glm::vec3 edge2(const size_t i) const {
+        return glm::vec3(e2_x[i], e2_y[i], e2_z[i]);
+    }
+    
+    AABB extent(const size_t i) const {
+        const glm::vec3 v0 = vertex(i);
+        
+        AABB extent = AABB::empty();
+        extent.grow(v0);
+        extent.grow(v0 + edge1(i));
+        extent.grow(v0 + edge2(i));
+        
+        return extent;
+    }
+    
+    // returns a copy where triangle i is the one at order[i] in this buffer
+    TriangleBuffer reordered(const std::vector<uint32_t>& order) const {
+        const auto gather = [&order](const auto& source) {
+            std::decay_t<decltype(source)> destination;
+            destination.reserve(order.size());
+            
+            for(const uint32_t i : order)
+                destination.push_back(source[i]);
+            
+            return destination;
+        };
+        
+        TriangleBuffer buffer;
+        buffer.v0_x = gather(v0_x);
+        buffer.v0_y = gather(v0_y);
+        buffer.v0_z = gather(v0_z);
+        buffer.e1_x = gather(e1_x);
+        buffer.e1_y = gather(e1_y);
+        buffer.e1_z = gather(e1_z);
+        buffer.e2_x = gather(e2_x);
+        buffer.e2_y = gather(e2_y);
+        buffer.e2_z = gather(e2_z);
+        buffer.meshes = gather(meshes);
+        buffer.faces = gather(faces);
+        buffer.finish();
+        
+        return buffer;
+    }
+    
+    // finds the closest triangle in [begin, end) hit between epsilon and t_max. this is the reference version,
+    // intersect() gives the same results but tests several triangles at a time where the cpu allows it
+    bool intersect_scalar(const Ray ray, const size_t begin, const size_t end, const float t_max, TriangleHit& hit) const {
+        bool intersection = false;
+        float t_closest = t_max;
+        
+        for(size_t i = begin; i < end; i++) {
+            float t = std::numeric_limits<float>::infinity(), u, v;
+            if(intersections::ray_triangle_edges(ray, vertex(i), edge1(i), edge2(i), t, u, v)) {
+                if(t < t_closest && t > epsilon) {
+                    hit = {static_cast<uint32_t>(i), t, u, v};
+                    t_closest = t;
+                    intersection = true;
+                }
+            }
+        }
+        
+        return intersection;
+    }
+    
+    bool intersect(const Ray ray, const size_t begin, const size_t end, const float t_max, TriangleHit& hit) const;
+};
+
+#if defined(RAYTRACER_AVX2)
+
+inline bool TriangleBuffer::intersect(const Ray ray, const size_t begin, const size_t end, const float t_max, TriangleHit& hit) const {
+    const __m256 dir_x = _mm256_set1_ps(ray.direction.x);
+    const __m256 dir_y = _mm256_set1_ps(ray.direction.y);
+    const __m256 dir_z = _mm256_set1_ps(ray.direction.z);
+    
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 eps = _mm256_set1_ps(epsilon);
+    const __m256 sign_mask = _mm256_set1_ps(-0.0f);
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    
+    bool intersection = false;
+    float t_closest = t_max;
+    
+    for(size_t base = begin; base < end; base += 8) {
+        const __m256 t_vec_x = _mm256_sub_ps(_mm256_set1_ps(ray.origin.x), _mm256_loadu_ps(&v0_x[base]));
+        const __m256 t_vec_y = _mm256_sub_ps(_mm256_set1_ps(ray.origin.y), _mm256_loadu_ps(&v0_y[base]));
+        const __m256 t_vec_z = _mm256_sub_ps(_mm256_set1_ps(ray.origin.z), _mm256_loadu_ps(&v0_z[base]));
+        
+        const __m256 edge1_x = _mm256_loadu_ps(&e1_x[base]);
+        const __m256 edge1_y = _mm256_loadu_ps(&e1_y[base]);
+        const __m256 edge1_z = _mm256_loadu_ps(&e1_z[base]);
+        
+        const __m256 edge2_x = _mm256_loadu_ps(&e2_x[base]);
+        const __m256 edge2_y = _mm256_loadu_ps(&e2_y[base]);
+        const __m256 edge2_z = _mm256_loadu_ps(&e2_z[base]);
+        
+        // pvec = cross(direction, e2)
+        const __m256 p_x = _mm256_fmsub_ps(dir_y, edge2_z, _mm256_mul_ps(dir_z, edge2_y));
+        const __m256 p_y = _mm256_fmsub_ps(dir_z, edge2_x, _mm256_mul_ps(dir_x, edge2_z));
+        const __m256 p_z = _mm256_fmsub_ps(dir_x, edge2_y, _mm256_mul_ps(dir_y, edge2_x));
+        
+        const __m256 det = _mm256_fmadd_ps(edge1_x, p_x, _mm256_fmadd_ps(edge1_y, p_y, _mm256_mul_ps(edge1_z, p_z)));
+        const __m256 inv_det = _mm256_div_ps(one, det);
+        
+        const __m256 u = _mm256_mul_ps(_mm256_fmadd_ps(t_vec_x, p_x, _mm256_fmadd_ps(t_vec_y, p_y, _mm256_mul_ps(t_vec_z, p_z))), inv_det);
+        
+        // qvec = cross(tvec, e1)
+        const __m256 q_x = _mm256_fmsub_ps(t_vec_y, edge1_z, _mm256_mul_ps(t_vec_z, edge1_y));
+        const __m256 q_y = _mm256_fmsub_ps(t_vec_z, edge1_x, _mm256_mul_ps(t_vec_x, edge1_z));
+        const __m256 q_z = _mm256_fmsub_ps(t_vec_x, edge1_y, _mm256_mul_ps(t_vec_y, edge1_x));
+        
+        const __m256 v = _mm256_mul_ps(_mm256_fmadd_ps(dir_x, q_x, _mm256_fmadd_ps(dir_y, q_y, _mm256_mul_ps(dir_z, q_z))), inv_det);
+        const __m256 t = _mm256_mul_ps(_mm256_fmadd_ps(edge2_x, q_x, _mm256_fmadd_ps(edge2_y, q_y, _mm256_mul_ps(edge2_z, q_z))), inv_det);
+        
+        // the same rejections as the scalar version, plus lanes past the end of the range
+        __m256 mask = _mm256_cmp_ps(_mm256_andnot_ps(sign_mask, det), eps, _CMP_GE_OQ);
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(u, one, _CMP_LE_OQ));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, eps, _CMP_GT_OQ));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, _mm256_set1_ps(t_closest), _CMP_LT_OQ));
+        mask = _mm256_and_ps(mask, _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(static_cast<int>(end - base)), lanes)));
+        
+        const int lanes_hit = _mm256_movemask_ps(mask);
+        if(lanes_hit == 0)
+            continue;
+        
+        alignas(32) float t_lanes[8], u_lanes[8], v_lanes[8];
+        _mm256_store_ps(t_lanes, t);
+        _mm256_store_ps(u_lanes, u);
+        _mm256_store_ps(v_lanes, v);
+        
+        for(int lane = 0; lane < 8; lane++) {
+            if((lanes_hit & (1 << lane)) && t_lanes[lane] < t_closest) {
+                hit = {static_cast<uint32_t>(base + lane), t_lanes[lane], u_lanes[lane], v_lanes[lane]};
+                t_closest = t_lanes[lane];
+                intersection = true;
+            }
+        }
+    }
+    
+    return intersection;
+}
+
+#elif defined(RAYTRACER_SSE2)
+
+inline bool TriangleBuffer::intersect(const Ray ray, const size_t begin, const size_t end, const float t_max, TriangleHit& hit) const {
+    const __m128 dir_x = _mm_set1_ps(ray.direction.x);
+    const __m128 dir_y = _mm_set1_ps(ray.direction.y);
+    const __m128 dir_z = _mm_set1_ps(ray.direction.z);
+    
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 eps = _mm_set1_ps(epsilon);
+    const __m128 sign_mask = _mm_set1_ps(-0.0f);
+    const __m128i lanes = _mm_setr_epi32(0, 1, 2, 3);
+    
+    bool intersection = false;
+    float t_closest = t_max;
+    
+    for(size_t base = begin; base < end; base += 4) {
+        const __m128 t_vec_x = _mm_sub_ps(_mm_set1_ps(ray.origin.x), _mm_loadu_ps(&v0_x[base]));
+        const __m128 t_vec_y = _mm_sub_ps(_mm_set1_ps(ray.origin.y), _mm_loadu_ps(&v0_y[base]));
+        const __m128 t_vec_z = _mm_sub_ps(_mm_set1_ps(ray.origin.z), _mm_loadu_ps(&v0_z[base]));
+        
+        const __m128 edge1_x = _mm_loadu_ps(&e1_x[base]);
+        const __m128 edge1_y = _mm_loadu_ps(&e1_y[base]);
+        const __m128 edge1_z = _mm_loadu_ps(&e1_z[base]);
+        
+        const __m128 edge2_x = _mm_loadu_ps(&e2_x[base]);
+        const __m128 edge2_y = _mm_loadu_ps(&e2_y[base]);
+        const __m128 edge2_z = _mm_loadu_ps(&e2_z[base]);
+        
+        // pvec = cross(direction, e2)
+        const __m128 p_x = _mm_sub_ps(_mm_mul_ps(dir_y, edge2_z), _mm_mul_ps(dir_z, edge2_y));
+        const __m128 p_y = _mm_sub_ps(_mm_mul_ps(dir_z, edge2_x), _mm_mul_ps(dir_x, edge2_z));
+        const __m128 p_z = _mm_sub_ps(_mm_mul_ps(dir_x, edge2_y), _mm_mul_ps(dir_y, edge2_x));
+        
+        const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(edge1_x, p_x), _mm_mul_ps(edge1_y, p_y)), _mm_mul_ps(edge1_z, p_z));
+        const __m128 inv_det = _mm_div_ps(one, det);
+        
+        const __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(t_vec_x, p_x), _mm_mul_ps(t_vec_y, p_y)), _mm_mul_ps(t_vec_z, p_z)), inv_det);
+        
+        // qvec = cross(tvec, e1)
+        const __m128 q_x = _mm_sub_ps(_mm_mul_ps(t_vec_y, edge1_z), _mm_mul_ps(t_vec_z, edge1_y));
+        const __m128 q_y = _mm_sub_ps(_mm_mul_ps(t_vec_z, edge1_x), _mm_mul_ps(t_vec_x, edge1_z));
+        const __m128 q_z = _mm_sub_ps(_mm_mul_ps(t_vec_x, edge1_y), _mm_mul_ps(t_vec_y, edge1_x));
+        
+        const __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dir_x, q_x), _mm_mul_ps(dir_y, q_y)), _mm_mul_ps(dir_z, q_z)), inv_det);
+        const __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(edge2_x, q_x), _mm_mul_ps(edge2_y, q_y)), _mm_mul_ps(edge2_z, q_z)), inv_det);
+        
+        // the same rejections as the scalar version, plus lanes past the end of the range
+        __m128 mask = _mm_cmpge_ps(_mm_andnot_ps(sign_mask, det), eps);
+        mask = _mm_and_ps(mask, _mm_cmpge_ps(u, zero));
+        mask = _mm_and_ps(mask, _mm_cmple_ps(u, one));
+        mask = _mm_and_ps(mask, _mm_cmpge_ps(v, zero));
+        mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), one));
+        mask = _mm_and_ps(mask, _mm_cmpgt_ps(t, eps));
+        mask = _mm_and_ps(mask, _mm_cmplt_ps(t, _mm_set1_ps(t_closest)));
+        mask = _mm_and_ps(mask, _mm_castsi128_ps(_mm_cmpgt_epi32(_mm_set1_epi32(static_cast<int>(end - base)), lanes)));
+        
+        const int lanes_hit = _mm_movemask_ps(mask);
+        if(lanes_hit == 0)
+            continue;
+        
+        alignas(16) float t_lanes[4], u_lanes[4], v_lanes[4];
+        _mm_store_ps(t_lanes, t);
+        _mm_store_ps(u_lanes, u);
+        _mm_store_ps(v_lanes, v);
+        
+        for(int lane = 0; lane < 4; lane++) {
+            if((lanes_hit & (1 << lane)) && t_lanes[lane] < t_closest) {
+                hit = {static_cast<uint32_t>(base + lane), t_lanes[lane], u_lanes[lane], v_lanes[lane]};
+                t_closest = t_lanes[lane];
+                intersection = true;
+            }
+        }
+    }
+    
+    return intersection;
+}
+
+#else
+
+inline bool TriangleBuffer::intersect(const Ray ray, const size_t begin, const size_t end, const float t_max, TriangleHit& hit) const {
+    return intersect_scalar(ray, begin, end, t_max, hit);
+}
+
+#endif
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "simd.h"
+#include "bvh.h"
+
+constexpr int wide_bvh_width = 4;
+
+// a traversal step replaces one node with at most wide_bvh_width children, and the tree is no deeper than the binary one
+constexpr int wide_bvh_stack_size = (wide_bvh_width - 1) * bvh_max_depth + 1;
+
+/*
+ A node with up to four children, whose bounds are stored component by component so one ray can be tested against all
+ of them with a single set of simd instructions. Unused slots get inverted bounds, which no ray can hit.
+ */
+struct alignas(64) WideBVHNode {
+    std::array<float, wide_bvh_width> min_x, min_y, min_z;
+    std::array<float, wide_bvh_width> max_x, max_y, max_z;
+    
+    // child node index for interior children, first primitive for leaves
+    std::array<uint32_t, wide_bvh_width> offset;
+    
+    // number of primitives for leaf children, zero for interior ones and empty slots
+    std::array<uint32_t, wide_bvh_width> count;
+    
+    void set_child(const int slot, const AABB extent, const uint32_t child_offset, const uint32_t child_count) {
+        min_x[slot] = extent.min.x;
+        min_y[slot] = extent.min.y;
+        min_z[slot] = extent.min.z;
+        max_x[slot] = extent.max.x;
+        max_y[slot] = extent.max.y;
+        max_z[slot] = extent.max.z;
+        
+        offset[slot] = child_offset;
+        count[slot] = child_count;
+    }
+    
+    bool is_leaf(const int slot) const {
+        return count[slot] > 0;
+    }
+    
+    // slab test against every child at once. returns a bitmask of the children the ray enters before t_max and
+    // writes where it enters them. the near and far planes are picked by the ray's sign bits instead of sorted, which
+    // also makes the inverted bounds of empty slots miss
+    int intersect(const Ray& ray, const float t_max, std::array<float, wide_bvh_width>& t_entry) const {
+        const glm::vec3 inverse_direction = ray.inverse_direction;
+        
+        const auto& near_x = ray.sign[0] ? max_x : min_x;
+        const auto& far_x = ray.sign[0] ? min_x : max_x;
+        const auto& near_y = ray.sign[1] ? max_y : min_y;
+        const auto& far_y = ray.sign[1] ? min_y : max_y;
+        const auto& near_z = ray.sign[2] ? max_z : min_z;
+        const auto& far_z = ray.sign[2] ? min_z : max_z;
+
+#if defined(RAYTRACER_SSE2)
+        const __m128 origin_x = _mm_set1_ps(ray.origin.x);
+        const __m128 origin_y = _mm_set1_ps(ray.origin.y);
+        const __m128 origin_z = _mm_set1_ps(ray.origin.z);
+        
+        const __m128 inverse_x = _mm_set1_ps(inverse_direction.x);
+        const __m128 inverse_y = _mm_set1_ps(inverse_direction.y);
+        const __m128 inverse_z = _mm_set1_ps(inverse_direction.z);
+        
+        const __m128 t_near_x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(near_x.data()), origin_x), inverse_x);
+        const __m128 t_near_y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(near_y.data()), origin_y), inverse_y);
+        const __m128 t_near_z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(near_z.data()), origin_z), inverse_z);
+        
+        const __m128 exit_scale = _mm_set1_ps(slab_exit_scale);
+        const __m128 t_far_x = _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(far_x.data()), origin_x), inverse_x), exit_scale);
+        const __m128 t_far_y = _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(far_y.data()), origin_y), inverse_y), exit_scale);
+        const __m128 t_far_z = _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(far_z.data()), origin_z), inverse_z), exit_scale);
+        
+        const __m128 t_min = _mm_max_ps(_mm_max_ps(t_near_x, t_near_y), _mm_max_ps(t_near_z, _mm_setzero_ps()));
+        const __m128 t_max_vec = _mm_min_ps(_mm_min_ps(t_far_x, t_far_y), _mm_min_ps(t_far_z, _mm_set1_ps(t_max)));
+        
+        _mm_storeu_ps(t_entry.data(), t_min);
+        
+        return _mm_movemask_ps(_mm_cmple_ps(t_min, t_max_vec));
+#else
+        int mask = 0;
+        for(int i = 0; i < wide_bvh_width; i++) {
+            const float t_min = std::max(std::max((near_x[i] - ray.origin.x) * inverse_direction.x,
+                                                  (near_y[i] - ray.origin.y) * inverse_direction.y),
+                                         std::max((near_z[i] - ray.origin.z) * inverse_direction.z, 0.0f));
+            const float t_far = std::min(std::min((far_x[i] - ray.origin.x) * inverse_direction.x * slab_exit_scale,
+                                                  (far_y[i] - ray.origin.y) * inverse_direction.y * slab_exit_scale),
+                                         std::min((far_z[i] - ray.origin.z) * inverse_direction.z * slab_exit_scale, t_max));
+            
+            t_entry[i] = t_min;
+            if(t_min <= t_far)
+                mask |= 1 << i;
+        }
+        
+        return mask;
+#endif
+    }
+};
+
+/*
+ 4-wide BVH made by collapsing a binary one, always opening up the child with the largest surface area until a node
+ holds four children. Leaves keep the primitive ranges of the binary tree, so they index the same primitive array.
+ */
+struct WideBVH {
+    std::vector<WideBVHNode> nodes;
+    
+    template<typename UnderlyingType>
+    explicit WideBVH(const BVH<UnderlyingType>& bvh) {
+        if(bvh.nodes.empty())
+            return;
+        
+        nodes.reserve(bvh.nodes.size() / 2 + 1);
+        collapse(bvh.nodes, 0);
+    }
+
+private:
+    uint32_t collapse(const std::vector<BVHNode>& binary_nodes, const uint32_t binary_index) {
+        std::array<uint32_t, wide_bvh_width> children = {};
+        int num_children = 0;
+        
+        const BVHNode& binary_node = binary_nodes[binary_index];
+        if(binary_node.is_leaf()) {
+            children[num_children++] = binary_index;
+        } else {
+            children[num_children++] = binary_index + 1;
+            children[num_children++] = binary_node.offset;
+        }
+        
+        while(num_children < wide_bvh_width) {
+            int largest = -1;
+            float largest_area = -1.0f;
+            
+            for(int i = 0; i < num_children; i++) {
+                const BVHNode& child = binary_nodes[children[i]];
+                if(!child.is_leaf() && child.extent.surface_area() > largest_area) {
+                    largest = i;
+                    largest_area = child.extent.surface_area();
+                }
+            }
+            
+            if(largest == -1)
+                break;
+            
+            const uint32_t opened = children[largest];
+            children[largest] = opened + 1;
+            children[num_children++] = binary_nodes[opened].offset;
+        }
+        
+        const uint32_t node_index = static_cast<uint32_t>(nodes.size());
+        nodes.emplace_back();
+        
+        const AABB empty = AABB::empty();
+        for(int i = 0; i < wide_bvh_width; i++)
+            nodes[node_index].set_child(i, empty, 0, 0);
+        
+        for(int i = 0; i < num_children; i++) {
+            const BVHNode& child = binary_nodes[children[i]];
+            
+            if(child.is_leaf()) {
+                nodes[node_index].set_child(i, child.extent, child.offset, child.count);
+            } else {
+                const uint32_t child_index = collapse(binary_nodes, children[i]);
+                nodes[node_index].set_child(i, child.extent, child_index, 0);
+            }
+        }
+        
+        return node_index;
+    }
+};
@@ -0,0 +1,610 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "aabb.h"
+#include "camera.h"
+#include "intersections.h"
+#include "procedural.h"
+#include "random.h"
+#include "renderer.h"
+#include "scene.h"
+#include "thread_pool.h"
+
+using Clock = std::chrono::steady_clock;
+
+// set by the build to bench/references in the source tree, relative to the working directory otherwise
+#ifndef RAYTRACER_REFERENCE_DIR
+#define RAYTRACER_REFERENCE_DIR "bench/references"
+#endif
+
+// every input is generated from these seeds, so two builds are always measured on the same rays and geometry
+constexpr uint64_t ray_seed = 1;
+constexpr uint64_t geometry_seed = 2;
+constexpr uint64_t sampler_seed = 3;
+
+constexpr int num_rays = 4096;
+constexpr int num_primitives = 64;
+
+// results of every benchmark end up in here, so the compiler can't drop the work that produced them
+volatile uint64_t sink = 0;
+
+struct BenchmarkOptions {
+    std::string_view filter;
+    double min_time = 0.5;
+    
+    // golden scene renders, compared against the references in reference_dir
+    bool render = false;
+    std::string reference_dir = RAYTRACER_REFERENCE_DIR;
+    bool bless = false;
+    float tolerance = 0.01f;
+    int num_threads = 0;
+    
+    // compare the hemisphere samplers instead of benchmarking anything
+    bool convergence = false;
+};
+
+void print_usage(const char* program) {
+    std::fprintf(stderr,
+                 "usage: %s [options]\n"
+                 "  --filter <text>              only run benchmarks whose name contains text\n"
+                 "  --min-time <seconds>         how long each benchmark runs at least, 0.5 by default\n"
+                 "  --triangles <n>              triangles in the soup scene, 100000 by default\n"
+                 "  --render                     render the golden scenes with every accelerator instead\n"
+                 "  --references <dir>           compare the renders against the references in dir instead of the checked in\n"
+                 "                               ones, fails if any differs\n"
+                 "  --bless                      write the bvh renders into the reference dir instead of comparing\n"
+                 "  --tolerance <rmse>           largest root mean square difference to a reference that passes, 0.01 by default\n"
+                 "  --threads <n>                worker threads for --render, one per hardware thread by default\n"
+                 "  --convergence                compare the noise of the indirect light samplers, fails if the cosine one is off\n",
+                 program);
+}
+
+// calls body until min_time has passed, body does ops operations per call and returns something derived from all of
+// them. prints the time per operation and operations per second, which for anything tracing rays is rays per second
+template<typename Body>
+void run_benchmark(const BenchmarkOptions& options, const char* name, const uint64_t ops, Body body) {
+    if(std::string_view(name).find(options.filter) == std::string_view::npos)
+        return;
+    
+    // one untimed call, so the first timed one doesn't pay for cold caches
+    sink = sink + body();
+    
+    uint64_t calls = 0;
+    const auto start = Clock::now();
+    Clock::duration elapsed;
+    
+    do {
+        sink = sink + body();
+        calls++;
+        elapsed = Clock::now() - start;
+    } while(std::chrono::duration<double>(elapsed).count() < options.min_time);
+    
+    const double ns_per_op = std::chrono::duration<double, std::nano>(elapsed).count() / (calls * ops);
+    std::printf("%-40s %12.2f %12.2f\n", name, ns_per_op, 1e3 / ns_per_op);
+}
+
+// rays starting on a sphere of the given radius, aimed at random points in the cube of half size target_size
+std::vector<Ray> make_rays(const float radius, const float target_size) {
+    Random random(ray_seed);
+    
+    const auto uniform = [&random](const float size) {
+        const float x = random.uniform();
+        const float y = random.uniform();
+        const float z = random.uniform();
+        
+        return (glm::vec3(x, y, z) * 2.0f - 1.0f) * size;
+    };
+    
+    std::vector<Ray> rays;
+    rays.reserve(num_rays);
+    
+    while(rays.size() < num_rays) {
+        const glm::vec3 direction = uniform(1.0f);
+        if(glm::dot(direction, direction) > 1.0f || glm::dot(direction, direction) < 1e-4f)
+            continue;
+        
+        const glm::vec3 origin = glm::normalize(direction) * radius;
+        rays.emplace_back(origin, glm::normalize(uniform(target_size) - origin));
+    }
+    
+    return rays;
+}
+
+void bench_kernels(const BenchmarkOptions& options) {
+    const std::vector<Ray> rays = make_rays(3.0f, 0.5f);
+    
+    auto soup = make_triangle_soup(num_primitives, geometry_seed);
+    soup->compile_triangles();
+    const TriangleBuffer& triangles = soup->triangles;
+    
+    std::vector<glm::vec3> v0, v1, v2;
+    for(size_t i = 0; i < triangles.size(); i++) {
+        v0.emplace_back(triangles.v0_x[i], triangles.v0_y[i], triangles.v0_z[i]);
+        v1.push_back(v0.back() + glm::vec3(triangles.e1_x[i], triangles.e1_y[i], triangles.e1_z[i]));
+        v2.push_back(v0.back() + glm::vec3(triangles.e2_x[i], triangles.e2_y[i], triangles.e2_z[i]));
+    }
+    
+    std::vector<glm::vec4> spheres;
+    std::vector<AABB> boxes;
+    for(size_t i = 0; i < triangles.size(); i++) {
+        spheres.emplace_back(v0[i], 0.05f);
+        boxes.push_back(triangles.extent(i));
+    }
+    
+    const uint64_t ops = static_cast<uint64_t>(num_rays) * num_primitives;
+    
+    run_benchmark(options, "intersections::ray_triangle", ops, [&] {
+        uint64_t hits = 0;
+        for(const Ray& ray : rays) {
+            for(int i = 0; i < num_primitives; i++) {
+                float t, u, v;
+                hits += intersections::ray_triangle(ray, v0[i], v1[i], v2[i], t, u, v) != 0.0f;
+            }
+        }
+        
+        return hits;
+    });
+    
+    run_benchmark(options, "intersections::ray_sphere", ops, [&] {
+        uint64_t hits = 0;
+        for(const Ray& ray : rays) {
+            for(const glm::vec4& sphere : spheres)
+                hits += intersections::ray_sphere(ray, sphere);
+        }
+        
+        return hits;
+    });
+    
+    run_benchmark(options, "AABB::contains(Ray)", ops, [&] {
+        uint64_t hits = 0;
+        for(const Ray& ray : rays) {
+            for(const AABB& box : boxes)
+                hits += box.contains(ray);
+        }
+        
+        return hits;
+    });
+    
+    // the leaf test every traversal ends in, over a whole buffer at once
+    run_benchmark(options, "TriangleBuffer::intersect_scalar", ops, [&] {
+        uint64_t hits = 0;
+        for(const Ray& ray : rays) {
+            TriangleHit hit;
+            hits += triangles.intersect_scalar(ray, 0, triangles.size(), std::numeric_limits<float>::infinity(), hit);
+        }
+        
+        return hits;
+    });
+    
+    run_benchmark(options, "TriangleBuffer::intersect", ops, [&] {
+        uint64_t hits = 0;
+        for(const Ray& ray : rays) {
+            TriangleHit hit;
+            hits += triangles.intersect(ray, 0, triangles.size(), std::numeric_limits<float>::infinity(), hit);
+        }
+        
+        return hits;
+    });
+}
+
+void bench_scene(const BenchmarkOptions& options, const char* scene_name, const Scene& scene, const bool brute_force) {
+    const std::vector<Ray> rays = make_rays(4.0f, 1.0f);
+    
+    const auto closest_hit = [&](const char* function, auto test) {
+        const std::string name = std::string(function) + " " + scene_name;
+        
+        run_benchmark(options, name.c_str(), rays.size(), [&] {
+            uint64_t hits = 0;
+            for(const Ray& ray : rays)
+                hits += test(ray, scene).has_value();
+            
+            return hits;
+        });
+    };
+    
+    const auto any_hit = [&](const char* function, auto test) {
+        const std::string name = std::string(function) + " " + scene_name;
+        
+        run_benchmark(options, name.c_str(), rays.size(), [&] {
+            uint64_t hits = 0;
+            for(const Ray& ray : rays)
+                hits += test(ray, scene, std::numeric_limits<float>::infinity());
+            
+            return hits;
+        });
+    };
+    
+    // testing every triangle only finishes in reasonable time on small meshes
+    if(brute_force)
+        closest_hit("test_scene", test_scene);
+    
+    closest_hit("test_scene_octree", test_scene_octree);
+    closest_hit("test_scene_bvh", test_scene_bvh);
+    closest_hit("test_scene_wide_bvh", test_scene_wide_bvh);
+    
+    any_hit("occluded_scene_octree", occluded_scene_octree);
+    any_hit("occluded_scene_bvh", occluded_scene_bvh);
+    any_hit("occluded_scene_wide_bvh", occluded_scene_wide_bvh);
+}
+
+// the sphere over a red plane of load_example_scene, generated instead of loaded so it doesn't need the obj files
+void build_example_scene(Scene& scene) {
+    scene.add_mesh("sphere", make_sphere(64, 32))->color = {0, 0, 0};
+    
+    Object* plane = scene.add_mesh("plane", make_plane(10.0f));
+    plane->transform = glm::translate(glm::mat4(1.0f), glm::vec3(0, -1, 0));
+    plane->color = {1, 0, 0};
+}
+
+// one finely tessellated sphere, so the render is dominated by deep traversals of a single mesh
+void build_dense_scene(Scene& scene) {
+    scene.add_mesh("sphere", make_sphere(512, 256))->color = {0.8f, 0.8f, 0.8f};
+    
+    scene.add_mesh("plane", make_plane(10.0f))->transform = glm::translate(glm::mat4(1.0f), glm::vec3(0, -1, 0));
+}
+
+// a grid of instances of one sphere, to exercise the top level bvh
+void build_instances_scene(Scene& scene) {
+    auto sphere = make_sphere(32, 16);
+    
+    for(int z = 0; z < 8; z++) {
+        for(int x = 0; x < 8; x++) {
+            Object* object = scene.add_mesh("sphere", sphere);
+            object->transform = glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(x - 3.5f, -0.8f, z - 3.5f) * 0.5f), glm::vec3(0.2f));
+            object->color = glm::vec3(x / 7.0f, 0.5f, z / 7.0f);
+        }
+    }
+    
+    scene.add_mesh("plane", make_plane(10.0f))->transform = glm::translate(glm::mat4(1.0f), glm::vec3(0, -1, 0));
+}
+
+struct GoldenScene {
+    const char* name;
+    void (*build)(Scene&);
+    
+    // rendered with every accelerator, the rest stays as given
+    RenderSettings settings;
+    int passes;
+};
+
+// colors as a portable float map, rgb from the bottom row up like colors itself
+bool write_pfm(const std::string& path, const Image<glm::vec4>& image) {
+    std::ofstream file(path, std::ios::binary);
+    file << "PF\n" << image.width() << " " << image.height() << "\n-1.0\n";
+    
+    for(int32_t y = 0; y < image.height(); y++) {
+        for(int32_t x = 0; x < image.width(); x++) {
+            const glm::vec4 color = image.get(x, y);
+            const float rgb[3] = {color.r, color.g, color.b};
+            file.write(reinterpret_cast<const char*>(rgb), sizeof(rgb));
+        }
+    }
+    
+    return static_cast<bool>(file);
+}
+
+// only reads what write_pfm writes, little endian rgb
+bool read_pfm(const std::string& path, Image<glm::vec4>& image) {
+    std::ifstream file(path, std::ios::binary);
+    
+    std::string magic;
+    int32_t width = 0, height = 0;
+    float scale = 0.0f;
+    file >> magic >> width >> height >> scale;
+    file.get();
+    
+    if(!file || magic != "PF" || scale >= 0.0f)
+        return false;
+    
+    image.resize(width, height);
+    
+    for(int32_t y = 0; y < height; y++) {
+        for(int32_t x = 0; x < width; x++) {
+            float rgb[3];
+            file.read(reinterpret_cast<char*>(rgb), sizeof(rgb));
+            image.get(x, y) = glm::vec4(rgb[0], rgb[1], rgb[2], 1.0f);
+        }
+    }
+    
+    return static_cast<bool>(file);
+}
+
+// root mean square difference over every channel, infinite if the sizes don't match
+float rms_difference(const Image<glm::vec4>& a, const Image<glm::vec4>& b) {
+    if(a.width() != b.width() || a.height() != b.height())
+        return std::numeric_limits<float>::infinity();
+    
+    double sum = 0.0;
+    for(int32_t y = 0; y < a.height(); y++) {
+        for(int32_t x = 0; x < a.width(); x++) {
+            const glm::vec3 difference = glm::vec3(a.get(x, y)) - glm::vec3(b.get(x, y));
+            sum += glm::dot(difference, difference);
+        }
+    }
+    
+    return static_cast<float>(std::sqrt(sum / (3.0 * a.width() * a.height())));
+}
+
+// renders every golden scene with every accelerator through the same Renderer the ui and headless renderer use, timed
+// from start() until the last pass is done. returns false if any render didn't match its reference
+bool bench_render(const BenchmarkOptions& options) {
+    RenderSettings path_settings;
+    path_settings.integrator = Integrator::Path;
+    path_settings.samples_per_pixel = 4;
+    
+    RenderSettings recursive_settings;
+    recursive_settings.integrator = Integrator::Recursive;
+    
+    const GoldenScene golden_scenes[] = {
+        {"example", build_example_scene, recursive_settings, 2},
+        {"dense", build_dense_scene, path_settings, 4},
+        {"instances", build_instances_scene, path_settings, 4}
+    };
+    
+    const std::pair<const char*, Accelerator> accelerators[] = {
+        {"bvh", Accelerator::BVH},
+        {"bvh4", Accelerator::WideBVH},
+        {"octree", Accelerator::Octree}
+    };
+    
+    ThreadPool pool(options.num_threads);
+    bool passed = true;
+    
+    std::printf("%-24s %12s %12s %12s\n", "scene", "ms", "Mrays/s", "rmse");
+    
+    for(const GoldenScene& golden : golden_scenes) {
+        Scene scene;
+        golden.build(scene);
+        scene.generate_acceleration(&pool);
+        
+        Image<glm::vec4> reference;
+        const std::string reference_path = options.reference_dir + "/" + golden.name + ".pfm";
+        const bool has_reference = !options.reference_dir.empty() && !options.bless && read_pfm(reference_path, reference);
+        
+        for(const auto& [accelerator_name, accelerator] : accelerators) {
+            const std::string name = std::string(golden.name) + " " + accelerator_name;
+            if(name.find(options.filter) == std::string::npos)
+                continue;
+            
+            Renderer renderer(scene, pool, 128, 128);
+            renderer.settings = golden.settings;
+            renderer.settings.accelerator = accelerator;
+            
+            const auto start = Clock::now();
+            
+            renderer.start();
+            pool.wait();
+            
+            while(renderer.passes() < golden.passes) {
+                renderer.render_pass();
+                pool.wait();
+            }
+            
+            const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+            const double rays = static_cast<double>(renderer.total_stats().total_rays());
+            
+            std::printf("%-24s %12.1f %12.2f", name.c_str(), seconds * 1e3, rays / seconds / 1e6);
+            
+            if(options.bless && accelerator == Accelerator::BVH) {
+                if(!write_pfm(reference_path, renderer.colors)) {
+                    std::printf(" couldn't write %s", reference_path.c_str());
+                    passed = false;
+                }
+            } else if(has_reference) {
+                const float difference = rms_difference(renderer.colors, reference);
+                const bool matches = difference <= options.tolerance;
+                
+                std::printf(" %12.5f %s", difference, matches ? "ok" : "FAILED");
+                passed = passed && matches;
+            } else if(!options.reference_dir.empty() && !options.bless) {
+                std::printf(" %12s no reference", "-");
+                passed = false;
+            }
+            
+            std::printf("\n");
+        }
+    }
+    
+    return passed;
+}
+
+// one bounce of indirect light off the first hit, averaged over samples directions drawn with sample_direction.
+// weight is the diffuse brdf times the cosine over the pdf of the drawn direction
+template<typename Sampler, typename Weight>
+float estimate_indirect(const Scene& scene, const HitResult& hit, const int samples, Random& random, Sampler sample_direction, Weight weight) {
+    float sum = 0.0f;
+    
+    for(int i = 0; i < samples; i++) {
+        const float u1 = random.uniform();
+        const float u2 = random.uniform();
+        const glm::vec3 direction = sample_direction(u1, u2);
+        
+        if(const auto bounce = test_scene_bvh(Ray(bounce_origin(hit), around_normal(hit.normal, direction)), scene)) {
+            const glm::vec3 light = direct_light(*bounce, scene, occluded_scene_bvh);
+            sum += weight(direction) * (light.x + light.y + light.z) / 3.0f;
+        }
+    }
+    
+    return sum / samples;
+}
+
+// estimates one bounce of indirect light at the first hits of a small view of the example scene, repeated with fixed
+// seeds, once drawing directions uniformly and weighting them by the pdf and once drawing them cosine distributed.
+// prints the mean and the per-pixel variance of both, averaged over the view. returns false if the cosine sampler
+// doesn't converge to the reference or isn't less noisy than the uniform one
+bool bench_convergence() {
+    constexpr int view_size = 16;
+    constexpr int trials = 1000;
+    constexpr int reference_samples = 4096;
+    
+    Scene scene;
+    build_example_scene(scene);
+    scene.generate_acceleration();
+    
+    Camera camera;
+    camera.look_at(glm::vec3(4), glm::vec3(0));
+    
+    std::vector<HitResult> hits;
+    for(int y = 0; y < view_size; y++) {
+        for(int x = 0; x < view_size; x++) {
+            if(const auto hit = test_scene_bvh(camera.get_ray(x, y, view_size, view_size), scene))
+                hits.push_back(*hit);
+        }
+    }
+    
+    if(hits.empty()) {
+        std::printf("the convergence view doesn't hit anything\n");
+        return false;
+    }
+    
+    const auto uniform = [](const float u1, const float u2) { return uniform_hemisphere(u1, u2); };
+    const auto cosine = [](const float u1, const float u2) { return cosine_hemisphere(u1, u2); };
+    
+    // the diffuse brdf of a white surface is 1 / pi, the pdfs are 1 / (2 pi) and cos(theta) / pi
+    const auto uniform_weight = [](const glm::vec3 direction) { return 2.0f * direction.z; };
+    const auto cosine_weight = [](const glm::vec3) { return 1.0f; };
+    
+    // the reference uses the uniform sampler, so a cosine sampler with the wrong density can't agree with it by
+    // construction
+    std::vector<float> reference(hits.size());
+    double reference_mean = 0.0, reference_variance = 0.0;
+    
+    for(size_t i = 0; i < hits.size(); i++) {
+        Random random(sampler_seed, i);
+        
+        double sum = 0.0, sum_squares = 0.0;
+        for(int j = 0; j < reference_samples; j++) {
+            const float value = estimate_indirect(scene, hits[i], 1, random, uniform, uniform_weight);
+            sum += value;
+            sum_squares += value * value;
+        }
+        
+        reference[i] = static_cast<float>(sum / reference_samples);
+        reference_mean += reference[i];
+        reference_variance += sum_squares / reference_samples - reference[i] * reference[i];
+    }
+    
+    reference_mean /= hits.size();
+    reference_variance /= hits.size();
+    
+    std::printf("%zu pixels, %d trials each, reference %.6f from %d samples\n", hits.size(), trials, reference_mean, reference_samples);
+    std::printf("%-8s %-10s %12s %12s\n", "samples", "sampler", "mean", "variance");
+    
+    bool passed = true;
+    
+    for(const int samples : {1, 4, 16}) {
+        double means[2] = {}, variances[2] = {};
+        
+        for(size_t i = 0; i < hits.size(); i++) {
+            // both samplers see the same random numbers
+            Random uniform_random(sampler_seed + samples, i);
+            Random cosine_random(sampler_seed + samples, i);
+            
+            double sums[2] = {}, sum_squares[2] = {};
+            for(int j = 0; j < trials; j++) {
+                const float values[2] = {
+                    estimate_indirect(scene, hits[i], samples, uniform_random, uniform, uniform_weight),
+                    estimate_indirect(scene, hits[i], samples, cosine_random, cosine, cosine_weight)
+                };
+                
+                for(int k = 0; k < 2; k++) {
+                    sums[k] += values[k];
+                    sum_squares[k] += values[k] * values[k];
+                }
+            }
+            
+            for(int k = 0; k < 2; k++) {
+                const double mean = sums[k] / trials;
+                
+                means[k] += mean;
+                variances[k] += sum_squares[k] / trials - mean * mean;
+            }
+        }
+        
+        for(int k = 0; k < 2; k++) {
+            means[k] /= hits.size();
+            variances[k] /= hits.size();
+        }
+        
+        // the view's mean is off the reference by a few standard errors at most, the pixels being independent
+        const double standard_error = std::sqrt((variances[1] / trials + reference_variance / reference_samples) / hits.size());
+        const bool converges = std::abs(means[1] - reference_mean) <= 4.0 * standard_error;
+        const bool less_noisy = variances[1] < variances[0];
+        
+        std::printf("%-8d %-10s %12.6f %12.3e\n", samples, "uniform", means[0], variances[0]);
+        std::printf("%-8d %-10s %12.6f %12.3e %s\n", samples, "cosine", means[1], variances[1], converges && less_noisy ? "ok" : (converges ? "FAILED, noisier than uniform" : "FAILED, off the reference"));
+        
+        passed = passed && converges && less_noisy;
+    }
+    
+    return passed;
+}
+
+int main(int argc, char* argv[]) {
+    BenchmarkOptions options;
+    int num_triangles = 100000;
+    
+    for(int i = 1; i < argc; i++) {
+        const std::string_view arg = argv[i];
+        
+        if(arg == "--filter" && i + 1 < argc) {
+            options.filter = argv[++i];
+        } else if(arg == "--min-time" && i + 1 < argc) {
+            options.min_time = std::atof(argv[++i]);
+        } else if(arg == "--triangles" && i + 1 < argc) {
+            num_triangles = std::max(std::atoi(argv[++i]), 1);
+        } else if(arg == "--render") {
+            options.render = true;
+        } else if(arg == "--references" && i + 1 < argc) {
+            options.reference_dir = argv[++i];
+        } else if(arg == "--bless") {
+            options.bless = true;
+        } else if(arg == "--tolerance" && i + 1 < argc) {
+            options.tolerance = static_cast<float>(std::atof(argv[++i]));
+        } else if(arg == "--threads" && i + 1 < argc) {
+            options.num_threads = std::atoi(argv[++i]);
+        } else if(arg == "--convergence") {
+            options.convergence = true;
+        } else if(arg == "--help") {
+            print_usage(argv[0]);
+            return 0;
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    
+    if(options.render)
+        return bench_render(options) ? 0 : 1;
+    
+    if(options.convergence)
+        return bench_convergence() ? 0 : 1;
+    
+    std::printf("%-40s %12s %12s\n", "benchmark", "ns/op", "Mrays/s");
+    
+    bench_kernels(options);
+    
+    Scene spheres;
+    build_example_scene(spheres);
+    spheres.generate_acceleration();
+    
+    bench_scene(options, "(sphere)", spheres, true);
+    
+    Scene soup;
+    soup.add_mesh("soup", make_triangle_soup(num_triangles, geometry_seed))->transform = glm::scale(glm::mat4(1.0f), glm::vec3(2.0f));
+    soup.generate_acceleration();
+    
+    bench_scene(options, "(soup)", soup, false);
+    
+    return 0;
+}
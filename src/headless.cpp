@@ -0,0 +1,233 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "renderer.h"
+#include "scene.h"
+#include "thread_pool.h"
+
+// renders without opening a window, for machines that don't have a display
+void print_usage(const char* program) {
+    std::fprintf(stderr,
+                 "usage: %s [options]\n"
+                 "  --obj <path>                 add an instance of a mesh, can be repeated. without any the example scene is used\n"
+                 "  --position <x> <y> <z>       move the last added instance\n"
+                 "  --color <r> <g> <b>          color of the last added instance\n"
+                 "  --output <path>              png to write, output.png by default\n"
+                 "  --size <width> <height>      resolution, 256x256 by default\n"
+                 "  --threads <n>                worker threads, one per hardware thread by default\n"
+                 "  --spp <n>                    samples per pixel and pass\n"
+                 "  --passes <n>                 passes to accumulate, stops early once an adaptive render converged\n"
+                 "  --adaptive <threshold>       stop sampling pixels whose relative error is below threshold\n"
+                 "  --max-samples <n>            most samples an adaptive render gives a pixel\n"
+                 "  --integrator <recursive|path>\n"
+                 "  --accelerator <none|octree|bvh|bvh4>\n"
+                 "  --indirect <n>               indirect samples per hit of the recursive integrator\n"
+                 "  --bounces <n>                longest path of the path integrator\n"
+                 "  --display <combined|direct|indirect|reflect|time|nodes|triangles>\n"
+                 "                               what to write, the last three are heatmaps of the cost per sample\n"
+                 "  --seed <n>\n"
+                 "  --stats                      print rays per second by type and the traversal work per ray\n"
+                 "  --trace <path>               write a chrome trace of loading, building and every tile to path\n",
+                 program);
+}
+
+int main(int argc, char* argv[]) {
+    Scene scene;
+    Object* last_object = nullptr;
+    
+    std::string output = "output.png";
+    int num_threads = 0;
+    int num_passes = 1;
+    int width = 256, height = 256;
+    bool print_stats = false;
+    RenderSettings settings;
+    
+    // started before anything else, so loading the meshes is part of the trace too
+    std::string trace_path;
+    for(int i = 1; i + 1 < argc; i++) {
+        if(std::string_view(argv[i]) == "--trace") {
+            trace_path = argv[i + 1];
+            tracer.start();
+        }
+    }
+    
+    for(int i = 1; i < argc; i++) {
+        const std::string_view arg = argv[i];
+        
+        // how many values the option takes, fails if they aren't there
+        const auto values = [&](const int count) {
+            if(i + count >= argc) {
+                std::fprintf(stderr, "%s needs %d value(s)\n", argv[i], count);
+                std::exit(1);
+            }
+            
+            return argv + i + 1;
+        };
+        
+        if(arg == "--obj") {
+            last_object = scene.load_from_file(values(1)[0]);
+            if(last_object == nullptr) {
+                std::fprintf(stderr, "couldn't load %s\n", argv[i + 1]);
+                return 1;
+            }
+            i += 1;
+        } else if(arg == "--position" && last_object != nullptr) {
+            char** v = values(3);
+            last_object->transform = glm::translate(glm::mat4(1.0f), glm::vec3(std::atof(v[0]), std::atof(v[1]), std::atof(v[2])));
+            i += 3;
+        } else if(arg == "--color" && last_object != nullptr) {
+            char** v = values(3);
+            last_object->color = glm::vec3(std::atof(v[0]), std::atof(v[1]), std::atof(v[2]));
+            i += 3;
+        } else if(arg == "--output") {
+            output = values(1)[0];
+            i += 1;
+        } else if(arg == "--size") {
+            char** v = values(2);
+            width = std::max(std::atoi(v[0]), 1);
+            height = std::max(std::atoi(v[1]), 1);
+            i += 2;
+        } else if(arg == "--threads") {
+            num_threads = std::atoi(values(1)[0]);
+            i += 1;
+        } else if(arg == "--spp") {
+            settings.samples_per_pixel = std::max(std::atoi(values(1)[0]), 1);
+            i += 1;
+        } else if(arg == "--passes") {
+            num_passes = std::max(std::atoi(values(1)[0]), 1);
+            i += 1;
+        } else if(arg == "--adaptive") {
+            settings.adaptive = true;
+            settings.noise_threshold = static_cast<float>(std::atof(values(1)[0]));
+            i += 1;
+        } else if(arg == "--max-samples") {
+            settings.max_samples = std::atoi(values(1)[0]);
+            i += 1;
+        } else if(arg == "--integrator") {
+            const std::string_view name = values(1)[0];
+            if(name == "recursive") {
+                settings.integrator = Integrator::Recursive;
+            } else if(name == "path") {
+                settings.integrator = Integrator::Path;
+            } else {
+                std::fprintf(stderr, "unknown integrator %s\n", argv[i + 1]);
+                return 1;
+            }
+            i += 1;
+        } else if(arg == "--accelerator") {
+            const std::string_view name = values(1)[0];
+            if(name == "none") {
+                settings.accelerator = Accelerator::None;
+            } else if(name == "octree") {
+                settings.accelerator = Accelerator::Octree;
+            } else if(name == "bvh") {
+                settings.accelerator = Accelerator::BVH;
+            } else if(name == "bvh4") {
+                settings.accelerator = Accelerator::WideBVH;
+            } else {
+                std::fprintf(stderr, "unknown accelerator %s\n", argv[i + 1]);
+                return 1;
+            }
+            i += 1;
+        } else if(arg == "--indirect") {
+            settings.indirect_samples = std::atoi(values(1)[0]);
+            i += 1;
+        } else if(arg == "--bounces") {
+            settings.max_bounces = std::atoi(values(1)[0]);
+            i += 1;
+        } else if(arg == "--display") {
+            const std::string_view name = values(1)[0];
+            if(name == "combined") {
+                settings.display_mode = DisplayMode::Combined;
+            } else if(name == "direct") {
+                settings.display_mode = DisplayMode::Direct;
+            } else if(name == "indirect") {
+                settings.display_mode = DisplayMode::Indirect;
+            } else if(name == "reflect") {
+                settings.display_mode = DisplayMode::Reflect;
+            } else if(name == "time") {
+                settings.display_mode = DisplayMode::RenderTime;
+            } else if(name == "nodes") {
+                settings.display_mode = DisplayMode::NodesVisited;
+            } else if(name == "triangles") {
+                settings.display_mode = DisplayMode::TrianglesTested;
+            } else {
+                std::fprintf(stderr, "unknown display mode %s\n", argv[i + 1]);
+                return 1;
+            }
+            i += 1;
+        } else if(arg == "--seed") {
+            settings.seed = std::atoi(values(1)[0]);
+            i += 1;
+        } else if(arg == "--stats") {
+            print_stats = true;
+        } else if(arg == "--trace") {
+            values(1);
+            i += 1;
+        } else if(arg == "--help") {
+            print_usage(argv[0]);
+            return 0;
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    
+    ThreadPool pool(num_threads);
+    
+    if(scene.objects.empty()) {
+        if(!load_example_scene(scene, &pool)) {
+            std::fprintf(stderr, "couldn't load the example scene, sphere.obj and plane.obj have to be in the working directory\n");
+            return 1;
+        }
+    } else {
+        scene.generate_acceleration(&pool);
+    }
+    
+    size_t num_triangles = 0;
+    for(auto& [path, mesh] : scene.meshes)
+        num_triangles += mesh->triangles.size();
+    
+    std::printf("built acceleration structures for %zu triangles in %.3f s\n", num_triangles, scene.build_seconds);
+    
+    Renderer renderer(scene, pool, width, height);
+    renderer.settings = settings;
+    
+    const auto start = std::chrono::steady_clock::now();
+    
+    renderer.start();
+    pool.wait();
+    
+    while(renderer.passes() < num_passes && !renderer.finished()) {
+        renderer.render_pass();
+        pool.wait();
+    }
+    
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::printf("rendered %d pass(es) on %d thread(s) in %.3f s\n", renderer.passes(), pool.thread_count(), seconds);
+    
+    if(print_stats)
+        std::printf("%s\n", renderer.total_stats().summary(seconds).c_str());
+    
+    if(!renderer.write_png(output)) {
+        std::fprintf(stderr, "couldn't write %s\n", output.c_str());
+        return 1;
+    }
+    
+    if(!trace_path.empty()) {
+        tracer.stop();
+        
+        if(!tracer.write(trace_path)) {
+            std::fprintf(stderr, "couldn't write %s\n", trace_path.c_str());
+            return 1;
+        }
+    }
+    
+    return 0;
+}
@@ -1,95 +1,57 @@
 #include <iostream>
 #include <limits>
-#include <future>
 #include <vector>
 #include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
 #include <SDL.h>
 #include <array>
-
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include <stb_image_write.h>
+#include <atomic>
 
 #include "intersections.h"
 #include "camera.h"
 #include "image.h"
 #include "lighting.h"
 #include "scene.h"
+#include "renderer.h"
+#include "thread_pool.h"
 #include "glad/glad.h"
 #include "imgui.h"
 #include "imgui_impl_sdl.h"
 #include "imgui_impl_opengl3.h"
 
-#define TINYOBJLOADER_IMPLEMENTATION
-#include <tiny_obj_loader.h>
-
-// scene information
-constexpr int32_t width = 256, height = 256;
-bool use_bvh = true;
-
-const Camera camera = [] {
-    Camera camera;
-    camera.look_at(glm::vec3(4), glm::vec3(0));
-    
-    return camera;
-}();
-
-// internal variables
-constexpr int32_t tile_size = 32;
-constexpr int32_t num_tiles_x = width / tile_size;
-constexpr int32_t num_tiles_y = height / tile_size;
-
 // globals
 Scene scene = {};
-Image<glm::vec4, width, height> colors = {};
-bool image_dirty = false;
+ThreadPool pool;
+int num_threads = pool.thread_count();
+Renderer renderer(scene, pool);
 
-enum class DisplayMode {
-    Combined,
-    Direct,
-    Indirect,
-    Reflect
-};
+// keep adding passes after the first one finishes, until turned off again
+bool progressive = false;
+
+// resolution the next render uses
+int image_width = renderer.width(), image_height = renderer.height();
 
 const std::array diplay_mode_strings = {
     "Combined",
     "Direct",
     "Indirect",
-    "Reflect"
+    "Reflect",
+    "Render Time",
+    "Nodes Visited",
+    "Triangles Tested"
 };
 
-inline DisplayMode display_mode;
+const std::array accelerator_strings = {
+    "None",
+    "Octree",
+    "BVH",
+    "BVH4"
+};
 
-bool calculate_tile(const int32_t from_x, const int32_t to_width, const int32_t from_y, const int32_t to_height) {
-    for(int32_t y = from_y; y < (from_y + to_height); y++) {
-        for(int32_t x = from_x; x < (from_x + to_width); x++) {
-            Ray ray_camera = camera.get_ray(x, y, width, height);
-            
-            if(auto result = cast_scene(ray_camera, scene, use_bvh)) {
-                glm::vec3 chosen_display;
-                switch(display_mode) {
-                    case DisplayMode::Combined:
-                        chosen_display = result->combined;
-                        break;
-                    case DisplayMode::Direct:
-                        chosen_display = result->direct;
-                        break;
-                    case DisplayMode::Indirect:
-                        chosen_display = result->indirect;
-                        break;
-                    case DisplayMode::Reflect:
-                        chosen_display = result->reflect;
-                        break;
-                }
-                
-                colors.get(x, y) = glm::vec4(chosen_display, 1.0f);
-                
-                image_dirty = true;
-            }
-        }
-    }
-    
-    return true;
-}
+const std::array integrator_strings = {
+    "Recursive",
+    "Path"
+};
 
 GLuint quad_vao = 0;
 GLuint pixel_program = 0;
@@ -172,46 +134,20 @@ void setup_gfx() {
     glBindTexture(GL_TEXTURE_2D, pixels_texture);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, renderer.width(), renderer.height(), 0, GL_RGBA, GL_FLOAT, nullptr);
     glBindTexture(GL_TEXTURE_2D, 0);
 }
 
 void update_texture() {
+    TraceScope scope("update_texture");
+    
     glBindTexture(GL_TEXTURE_2D, pixels_texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_FLOAT, colors.array.data());
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, renderer.colors.pitch());
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, renderer.width(), renderer.height(), 0, GL_RGBA, GL_FLOAT, renderer.colors.data());
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
     glBindTexture(GL_TEXTURE_2D, 0);
 }
 
-std::vector<std::future<bool>> futures;
-
-void render() {
-    futures.clear();
-    colors.reset();
-    
-    for(int32_t y = 0; y < num_tiles_y; y++) {
-        for(int32_t x = 0; x < num_tiles_x; x++) {
-            auto f = std::async(std::launch::async, calculate_tile, x * tile_size, tile_size, y * tile_size, tile_size);
-            futures.push_back(std::move(f));
-        }
-    }
-}
-
-void dump_to_file() {
-    uint8_t pixels[width * height * 3] = {};
-    
-    int i = 0;
-    for(int32_t y = height - 1; y >= 0; y--) {
-        for(int32_t x = 0; x < width; x++) {
-            const glm::ivec4 c = colors.get(x, y);
-            pixels[i++] = c.r;
-            pixels[i++] = c.g;
-            pixels[i++] = c.b;
-        }
-    }
-
-    stbi_write_png("output.png", width, height, 3, pixels, width * 3);
-}
-
 template<typename UnderlyingType>
 void walk_node(Node<UnderlyingType>& node) {
     if(ImGui::TreeNode(&node, "min: (%f %f %f)\n max: (%f %f %f)", node.extent.min.x, node.extent.min.y, node.extent.min.z, node.extent.max.x, node.extent.max.y, node.extent.max.z)) {
@@ -227,8 +163,34 @@ void walk_node(Node<UnderlyingType>& node) {
     }
 }
 
+template<typename UnderlyingType>
+void walk_node(const BVH<UnderlyingType>& bvh, const uint32_t node_index) {
+    const BVHNode& node = bvh.nodes[node_index];
+    if(ImGui::TreeNode(&node, "min: (%f %f %f)\n max: (%f %f %f)", node.extent.min.x, node.extent.min.y, node.extent.min.z, node.extent.max.x, node.extent.max.y, node.extent.max.z)) {
+        ImGui::Text("Is leaf: %i", node.is_leaf());
+        ImGui::Text("Contained triangles: %u", node.count);
+
+        if(!node.is_leaf()) {
+            walk_node(bvh, node_index + 1);
+            walk_node(bvh, node.offset);
+        }
+        
+        ImGui::TreePop();
+    }
+}
+
 void walk_object(Object& object) {
-    walk_node(object.octree->root);
+    if(ImGui::TreeNode("Octree")) {
+        walk_node(object.mesh->octree->root);
+        
+        ImGui::TreePop();
+    }
+    
+    if(!object.mesh->bvh->nodes.empty() && ImGui::TreeNode("BVH")) {
+        walk_node(*object.mesh->bvh, 0);
+        
+        ImGui::TreePop();
+    }
 }
 
 int main(int, char*[]) {
@@ -276,15 +238,13 @@ int main(int, char*[]) {
         
         if(ImGui::BeginMainMenuBar()) {
             if(ImGui::BeginMenu("File")) {
+                // building uses the render threads, so whatever they were doing has to stop first
                 if(ImGui::Button("Load")) {
-                    auto& sphere = scene.load_from_file("sphere.obj");
-                    sphere.color = {0, 0, 0};
+                    pool.cancel();
+                    pool.wait();
                     
-                    auto& plane = scene.load_from_file("plane.obj");
-                    plane.position.y = -1;
-                    plane.color = {1, 0, 0};
-                    
-                    scene.generate_acceleration();
+                    if(!load_example_scene(scene, &pool))
+                        std::cerr << "couldn't load sphere.obj and plane.obj from the working directory" << std::endl;
                 }
                 
                 ImGui::EndMenu();
@@ -293,36 +253,122 @@ int main(int, char*[]) {
             ImGui::EndMainMenuBar();
         }
         
-        ImGui::Checkbox("Use BVH", &use_bvh);
-        ImGui::InputInt("Indirect Samples", &num_indirect_samples);
+        RenderSettings& settings = renderer.settings;
+        
+        if(ImGui::BeginCombo("Accelerator", accelerator_strings[static_cast<int>(settings.accelerator)])) {
+            if(ImGui::Selectable("None"))
+                settings.accelerator = Accelerator::None;
+            
+            if(ImGui::Selectable("Octree"))
+                settings.accelerator = Accelerator::Octree;
+            
+            if(ImGui::Selectable("BVH"))
+                settings.accelerator = Accelerator::BVH;
+            
+            if(ImGui::Selectable("BVH4"))
+                settings.accelerator = Accelerator::WideBVH;
+            
+            ImGui::EndCombo();
+        }
+        
+        if(ImGui::BeginCombo("Integrator", integrator_strings[static_cast<int>(settings.integrator)])) {
+            if(ImGui::Selectable("Recursive"))
+                settings.integrator = Integrator::Recursive;
+            
+            if(ImGui::Selectable("Path"))
+                settings.integrator = Integrator::Path;
+            
+            ImGui::EndCombo();
+        }
+        
+        ImGui::InputInt("Samples Per Pixel", &settings.samples_per_pixel);
+        settings.samples_per_pixel = std::max(settings.samples_per_pixel, 1);
+        
+        ImGui::InputInt("Indirect Samples", &settings.indirect_samples);
+        ImGui::InputInt("Max Bounces", &settings.max_bounces);
+        ImGui::InputInt("Seed", &settings.seed);
         
-        if(ImGui::BeginCombo("Display Mode", diplay_mode_strings[static_cast<int>(display_mode)])) {
+        if(ImGui::InputInt("Threads", &num_threads)) {
+            num_threads = std::max(num_threads, 1);
+            pool.resize(num_threads);
+        }
+        
+        if(ImGui::BeginCombo("Display Mode", diplay_mode_strings[static_cast<int>(settings.display_mode)])) {
             if(ImGui::Selectable("Combined"))
-                display_mode = DisplayMode::Combined;
+                settings.display_mode = DisplayMode::Combined;
             
             if(ImGui::Selectable("Direct"))
-                display_mode = DisplayMode::Direct;
+                settings.display_mode = DisplayMode::Direct;
             
             if(ImGui::Selectable("Indirect"))
-                display_mode = DisplayMode::Indirect;
+                settings.display_mode = DisplayMode::Indirect;
             
             if(ImGui::Selectable("Reflect"))
-                display_mode = DisplayMode::Reflect;
+                settings.display_mode = DisplayMode::Reflect;
+            
+            // cost per sample from blue to red, on a fixed log scale
+            if(ImGui::Selectable("Render Time"))
+                settings.display_mode = DisplayMode::RenderTime;
+            
+            if(ImGui::Selectable("Nodes Visited"))
+                settings.display_mode = DisplayMode::NodesVisited;
+            
+            if(ImGui::Selectable("Triangles Tested"))
+                settings.display_mode = DisplayMode::TrianglesTested;
             
             ImGui::EndCombo();
         }
         
-        if(ImGui::Button("Render"))
-            render();
+        ImGui::InputInt("Width", &image_width);
+        ImGui::InputInt("Height", &image_height);
+        
+        if(ImGui::Button("Render")) {
+            image_width = std::max(image_width, 1);
+            image_height = std::max(image_height, 1);
+            
+            if(image_width != renderer.width() || image_height != renderer.height())
+                renderer.resize(image_width, image_height);
+            
+            renderer.start();
+        }
+        
+        ImGui::Checkbox("Progressive", &progressive);
+        
+        ImGui::Checkbox("Adaptive", &settings.adaptive);
+        ImGui::InputFloat("Noise Threshold", &settings.noise_threshold);
+        ImGui::InputInt("Max Samples", &settings.max_samples);
+        
+        if(progressive && renderer.passes() > 0 && pool.idle() && !renderer.finished())
+            renderer.render_pass();
+        
+        ImGui::Text("Passes: %d", renderer.passes());
+        
+        if(settings.adaptive && pool.idle() && renderer.passes() > 0)
+            ImGui::Text("Converged: %.1f%%", 100.0f * renderer.converged_fraction());
+        
+        const ThreadPool::Stats stats = pool.last_stats();
+        ImGui::Text("Last pass: %.1f ms, %.1f%% idle", std::chrono::duration<double, std::milli>(stats.wall).count(), stats.idle_fraction() * 100.0);
+        ImGui::Text("Acceleration build: %.1f ms", scene.build_seconds * 1000.0);
+        
+        if(pool.idle() && renderer.passes() > 0)
+            ImGui::TextUnformatted(renderer.pass_stats().summary(std::chrono::duration<double>(stats.wall).count()).c_str());
         
         if(ImGui::Button("Dump to file"))
-            dump_to_file();
+            renderer.write_png("output.png");
         
-        if(image_dirty) {
-            update_texture();
-            image_dirty = false;
+        // everything between the two clicks ends up in trace.json, for chrome://tracing or ui.perfetto.dev
+        if(ImGui::Button(tracer.enabled() ? "Stop trace" : "Start trace")) {
+            if(tracer.enabled()) {
+                tracer.stop();
+                tracer.write("trace.json");
+            } else {
+                tracer.start();
+            }
         }
         
+        if(renderer.image_dirty.exchange(false))
+            update_texture();
+        
         for(auto& object : scene.objects) {
             if(ImGui::TreeNode("Object")) {
                 walk_object(*object);
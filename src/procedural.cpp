@@ -0,0 +1,112 @@
+#include "procedural.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "random.h"
+
+constexpr float pi = 3.14159265358979323846f;
+
+// fills the mesh the way tinyobj would for a file with one shape, indices index both positions and normals
+void fill_mesh(Mesh& mesh, const std::vector<glm::vec3>& positions, const std::vector<glm::vec3>& normals, const std::vector<int>& indices) {
+    for(size_t i = 0; i < positions.size(); i++) {
+        mesh.attrib.vertices.insert(mesh.attrib.vertices.end(), {positions[i].x, positions[i].y, positions[i].z});
+        mesh.attrib.normals.insert(mesh.attrib.normals.end(), {normals[i].x, normals[i].y, normals[i].z});
+    }
+    
+    tinyobj::shape_t shape;
+    shape.name = "procedural";
+    
+    for(const int index : indices)
+        shape.mesh.indices.push_back({index, index, -1});
+    
+    shape.mesh.num_face_vertices.assign(indices.size() / 3, 3);
+    shape.mesh.material_ids.assign(indices.size() / 3, -1);
+    
+    mesh.shapes.push_back(std::move(shape));
+}
+
+std::shared_ptr<Mesh> make_sphere(const int segments, const int rings) {
+    std::vector<glm::vec3> positions;
+    std::vector<int> indices;
+    
+    for(int ring = 0; ring <= rings; ring++) {
+        const float theta = pi * ring / rings;
+        
+        for(int segment = 0; segment <= segments; segment++) {
+            const float phi = 2.0f * pi * segment / segments;
+            
+            positions.emplace_back(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+        }
+    }
+    
+    // the first and last ring collapse into the poles, so they only get one triangle per segment
+    for(int ring = 0; ring < rings; ring++) {
+        for(int segment = 0; segment < segments; segment++) {
+            const int a = ring * (segments + 1) + segment;
+            const int b = a + segments + 1;
+            
+            if(ring != 0)
+                indices.insert(indices.end(), {a, a + 1, b});
+            
+            if(ring != rings - 1)
+                indices.insert(indices.end(), {a + 1, b + 1, b});
+        }
+    }
+    
+    auto mesh = std::make_shared<Mesh>();
+    fill_mesh(*mesh, positions, positions, indices);
+    
+    return mesh;
+}
+
+std::shared_ptr<Mesh> make_plane(const float size) {
+    const float h = size / 2.0f;
+    
+    const std::vector<glm::vec3> positions = {{-h, 0, -h}, {h, 0, -h}, {h, 0, h}, {-h, 0, h}};
+    const std::vector<glm::vec3> normals(4, glm::vec3(0, 1, 0));
+    
+    auto mesh = std::make_shared<Mesh>();
+    fill_mesh(*mesh, positions, normals, {0, 2, 1, 0, 3, 2});
+    
+    return mesh;
+}
+
+std::shared_ptr<Mesh> make_triangle_soup(const int count, const uint64_t seed) {
+    Random random(seed);
+    
+    const auto point = [&random] {
+        const float x = random.uniform();
+        const float y = random.uniform();
+        const float z = random.uniform();
+        
+        return glm::vec3(x, y, z) - 0.5f;
+    };
+    
+    std::vector<glm::vec3> positions, normals;
+    std::vector<int> indices;
+    
+    // small triangles scattered through the cube, roughly as dense as a real mesh of the same count
+    const float size = 2.0f / std::cbrt(static_cast<float>(std::max(count, 1)));
+    
+    for(int i = 0; i < count; i++) {
+        const glm::vec3 center = point();
+        const glm::vec3 v0 = center + point() * size;
+        const glm::vec3 v1 = center + point() * size;
+        const glm::vec3 v2 = center + point() * size;
+        
+        const glm::vec3 normal = glm::normalize(glm::cross(v1 - v0, v2 - v0));
+        
+        for(const glm::vec3 v : {v0, v1, v2}) {
+            indices.push_back(static_cast<int>(positions.size()));
+            positions.push_back(v);
+            normals.push_back(normal);
+        }
+    }
+    
+    auto mesh = std::make_shared<Mesh>();
+    fill_mesh(*mesh, positions, normals, indices);
+    
+    return mesh;
+}
@@ -0,0 +1,333 @@
+#include "renderer.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <vector>
+#include <glm/gtc/matrix_transform.hpp>
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
+// tiles a pass is cut into, and the smallest piece one gets split into for idle workers
+constexpr int32_t tile_size = 32;
+constexpr int32_t min_tile_size = 4;
+
+// adaptive sampling judges no pixel on fewer samples than this, and holds pixels darker than adaptive_min_luminance
+// to the same absolute error as one that bright
+constexpr int adaptive_min_samples = 16;
+constexpr float adaptive_min_luminance = 0.05f;
+
+// the heatmaps show cost per sample on a log scale that's red at these. fixed rather than relative to the image, so
+// renders with different accelerators can be compared side by side
+constexpr float heatmap_max_nanoseconds = 100000.0f;
+constexpr float heatmap_max_nodes = 1000.0f;
+constexpr float heatmap_max_triangles = 1000.0f;
+
+glm::vec3 display_value(const SceneResult& result, const DisplayMode display_mode) {
+    switch(display_mode) {
+        case DisplayMode::Combined:
+        case DisplayMode::RenderTime:
+        case DisplayMode::NodesVisited:
+        case DisplayMode::TrianglesTested:
+            return result.combined;
+        case DisplayMode::Direct:
+            return result.direct;
+        case DisplayMode::Indirect:
+            return result.indirect;
+        case DisplayMode::Reflect:
+            return result.reflect;
+    }
+    
+    return result.combined;
+}
+
+float luminance(const glm::vec3 color) {
+    return glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+// blue through cyan, green and yellow to red as cost goes from nothing to max_cost
+glm::vec3 heatmap_color(const float cost, const float max_cost) {
+    const std::array<glm::vec3, 5> stops = {
+        glm::vec3(0, 0, 1),
+        glm::vec3(0, 1, 1),
+        glm::vec3(0, 1, 0),
+        glm::vec3(1, 1, 0),
+        glm::vec3(1, 0, 0)
+    };
+    
+    const float t = std::clamp(std::log1p(cost) / std::log1p(max_cost), 0.0f, 1.0f) * (stops.size() - 1);
+    const int i = std::min(static_cast<int>(t), static_cast<int>(stops.size()) - 2);
+    
+    return glm::mix(stops[i], stops[i + 1], t - i);
+}
+
+// cost of one sample on average, in whatever the display mode measures
+glm::vec3 heatmap_display(const float cost, const DisplayMode display_mode) {
+    switch(display_mode) {
+        case DisplayMode::NodesVisited:
+            return heatmap_color(cost, heatmap_max_nodes);
+        case DisplayMode::TrianglesTested:
+            return heatmap_color(cost, heatmap_max_triangles);
+        default:
+            return heatmap_color(cost, heatmap_max_nanoseconds);
+    }
+}
+
+bool same_estimate(const RenderSettings& a, const RenderSettings& b) {
+    // heatmaps accumulate the combined image underneath, their costs start over on their own. the accelerator doesn't
+    // change the image, but it does change what the heatmaps measure
+    const auto accumulated_mode = [](const DisplayMode display_mode) {
+        return is_heatmap(display_mode) ? DisplayMode::Combined : display_mode;
+    };
+    
+    return a.accelerator == b.accelerator && a.integrator == b.integrator && a.seed == b.seed && a.indirect_samples == b.indirect_samples && a.max_bounces == b.max_bounces && accumulated_mode(a.display_mode) == accumulated_mode(b.display_mode);
+}
+
+void Renderer::start() {
+    pool.cancel();
+    pool.wait();
+    
+    colors.reset();
+    accumulation.reset();
+    luminance_squares.reset();
+    pixel_costs.reset();
+    pass_settings = settings;
+    num_passes = 0;
+    
+    {
+        std::lock_guard lock(stats_mutex);
+        accumulated_stats = {};
+    }
+    
+    render_pass();
+}
+
+void Renderer::resize(const int32_t width, const int32_t height) {
+    pool.cancel();
+    pool.wait();
+    
+    colors.resize(width, height);
+    accumulation.resize(width, height);
+    luminance_squares.resize(width, height);
+    pixel_costs.resize(width, height);
+    num_passes = 0;
+    pixels_sampled = 0;
+}
+
+void Renderer::render_pass() {
+    // samples of something else can't be averaged into what's accumulated
+    if(num_passes > 0 && !same_estimate(settings, pass_settings)) {
+        start();
+        return;
+    }
+    
+    TraceScope scope("render_pass");
+    
+    const int pass = num_passes++;
+    pixels_sampled = 0;
+    
+    // the tiles only read the copy, so nothing changes halfway through a pass. costs measured before switching into a
+    // heatmap are either missing or of another measure, so they start over
+    if(settings.display_mode != pass_settings.display_mode && is_heatmap(settings.display_mode))
+        pixel_costs.reset();
+    
+    pass_settings = settings;
+    
+    {
+        std::lock_guard lock(stats_mutex);
+        last_pass_stats = {};
+    }
+    
+    const int32_t num_tiles_x = (width() + tile_size - 1) / tile_size;
+    const int32_t num_tiles_y = (height() + tile_size - 1) / tile_size;
+    
+    for(int32_t y = 0; y < num_tiles_y; y++) {
+        for(int32_t x = 0; x < num_tiles_x; x++) {
+            const int32_t from_x = x * tile_size;
+            const int32_t from_y = y * tile_size;
+            
+            pool.submit([this, from_x, from_y, pass] {
+                run_tile(from_x, std::min(tile_size, width() - from_x), from_y, std::min(tile_size, height() - from_y), pass);
+            });
+        }
+    }
+}
+
+bool Renderer::converged(const int32_t x, const int32_t y) const {
+    const glm::vec4 accumulated = accumulation.get(x, y);
+    const float count = accumulated.a;
+    
+    if(count >= pass_settings.max_samples)
+        return true;
+    
+    if(count < adaptive_min_samples)
+        return false;
+    
+    const float mean = luminance(glm::vec3(accumulated)) / count;
+    const float variance = std::max(luminance_squares.get(x, y) / count - mean * mean, 0.0f) * count / (count - 1.0f);
+    const float standard_error = std::sqrt(variance / count);
+    
+    return standard_error <= pass_settings.noise_threshold * std::max(mean, adaptive_min_luminance);
+}
+
+// returns whether the pixel took any samples
+bool Renderer::calculate_pixel(const int32_t x, const int32_t y, const int pass) {
+    if(pass_settings.adaptive && converged(x, y))
+        return false;
+    
+    Ray ray_camera = camera.get_ray(x, y, width(), height());
+    
+    // one stream per pixel and pass, so the image only depends on the seed and not on which thread rendered what
+    const uint64_t pass_seed = static_cast<uint64_t>(static_cast<uint32_t>(pass_settings.seed)) | (static_cast<uint64_t>(pass) << 32);
+    Random random(pass_seed, static_cast<uint64_t>(y) * width() + x);
+    
+    glm::vec3 sum(0.0f);
+    float sum_squares = 0.0f;
+    bool any_hit = false;
+    
+    // only measured when shown, the clock isn't free next to a cheap pixel
+    const bool heatmap = is_heatmap(pass_settings.display_mode);
+    const RenderStats stats_before = heatmap ? thread_stats : RenderStats();
+    const auto time_before = heatmap ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+    
+    for(int i = 0; i < pass_settings.samples_per_pixel; i++) {
+        const auto result = pass_settings.integrator == Integrator::Path ? trace_path(ray_camera, scene, random, pass_settings.accelerator, pass_settings.max_bounces) : cast_scene(ray_camera, scene, random, pass_settings.accelerator, pass_settings.indirect_samples);
+        if(result) {
+            const glm::vec3 value = display_value(*result, pass_settings.display_mode);
+            
+            sum += value;
+            sum_squares += luminance(value) * luminance(value);
+            any_hit = true;
+        }
+    }
+    
+    glm::vec4& accumulated = accumulation.get(x, y);
+    accumulated += glm::vec4(sum, static_cast<float>(pass_settings.samples_per_pixel));
+    luminance_squares.get(x, y) += sum_squares;
+    
+    // misses are shown too, since they can cost as much as hits
+    if(heatmap) {
+        glm::vec2& cost = pixel_costs.get(x, y);
+        
+        switch(pass_settings.display_mode) {
+            case DisplayMode::NodesVisited:
+                cost.x += thread_stats.nodes_visited - stats_before.nodes_visited;
+                break;
+            case DisplayMode::TrianglesTested:
+                cost.x += thread_stats.triangles_tested - stats_before.triangles_tested;
+                break;
+            default:
+                cost.x += std::chrono::duration<float, std::nano>(std::chrono::steady_clock::now() - time_before).count();
+                break;
+        }
+        
+        cost.y += pass_settings.samples_per_pixel;
+        
+        colors.get(x, y) = glm::vec4(heatmap_display(cost.x / cost.y, pass_settings.display_mode), 1.0f);
+        
+        image_dirty = true;
+    } else if(any_hit) {
+        colors.get(x, y) = glm::vec4(glm::vec3(accumulated) / accumulated.a, 1.0f);
+        
+        image_dirty = true;
+    }
+    
+    return true;
+}
+
+void Renderer::calculate_tile(const int32_t from_x, const int32_t to_width, const int32_t from_y, const int32_t to_height, const int pass) {
+    int sampled = 0;
+    
+    for(int32_t y = from_y; y < (from_y + to_height); y++) {
+        const int32_t rows_left = from_y + to_height - y;
+        
+        // once another worker runs dry, hand it half of what's left here, so the frame doesn't end waiting on one expensive tile
+        if(pool.starving() && std::max(rows_left, to_width) >= 2 * min_tile_size) {
+            if(rows_left >= to_width) {
+                const int32_t half = rows_left / 2;
+                
+                pool.submit([=] { run_tile(from_x, to_width, y + half, rows_left - half, pass); });
+                calculate_tile(from_x, to_width, y, half, pass);
+            } else {
+                const int32_t half = to_width / 2;
+                
+                pool.submit([=] { run_tile(from_x + half, to_width - half, y, rows_left, pass); });
+                calculate_tile(from_x, half, y, rows_left, pass);
+            }
+            
+            break;
+        }
+        
+        for(int32_t x = from_x; x < (from_x + to_width); x++)
+            sampled += calculate_pixel(x, y, pass);
+    }
+    
+    pixels_sampled += sampled;
+}
+
+// what every job runs, so the counters of one tile end up in the pass no matter which worker took it
+void Renderer::run_tile(const int32_t from_x, const int32_t to_width, const int32_t from_y, const int32_t to_height, const int pass) {
+    TraceScope scope("calculate_tile");
+    scope.arg("x", from_x);
+    scope.arg("y", from_y);
+    scope.arg("width", to_width);
+    scope.arg("height", to_height);
+    scope.arg("pass", pass);
+    
+    thread_stats = {};
+    
+    calculate_tile(from_x, to_width, from_y, to_height, pass);
+    
+    std::lock_guard lock(stats_mutex);
+    last_pass_stats += thread_stats;
+    accumulated_stats += thread_stats;
+}
+
+bool Renderer::write_png(const std::string& path) const {
+    TraceScope scope("write_png");
+    
+    std::vector<uint8_t> pixels(static_cast<size_t>(width()) * height() * 3);
+    
+    size_t i = 0;
+    for(int32_t y = height() - 1; y >= 0; y--) {
+        const glm::vec4* row = colors.row(y);
+        
+        for(int32_t x = 0; x < width(); x++) {
+            const glm::vec4 c = glm::clamp(row[x], 0.0f, 1.0f) * 255.0f + 0.5f;
+            pixels[i++] = static_cast<uint8_t>(c.r);
+            pixels[i++] = static_cast<uint8_t>(c.g);
+            pixels[i++] = static_cast<uint8_t>(c.b);
+        }
+    }
+    
+    return stbi_write_png(path.c_str(), width(), height(), 3, pixels.data(), width() * 3) != 0;
+}
+
+bool load_example_scene(Scene& scene, ThreadPool* pool) {
+    const size_t num_objects = scene.objects.size();
+    const bool had_sphere = scene.meshes.count("sphere.obj") > 0;
+    
+    Object* sphere = scene.load_from_file("sphere.obj");
+    Object* plane = sphere != nullptr ? scene.load_from_file("plane.obj") : nullptr;
+    
+    // a failed load leaves the scene as it was, so only the sphere has to be taken out again
+    if(plane == nullptr) {
+        scene.objects.erase(scene.objects.begin() + num_objects, scene.objects.end());
+        
+        if(!had_sphere)
+            scene.meshes.erase("sphere.obj");
+        
+        return false;
+    }
+    
+    sphere->color = {0, 0, 0};
+    
+    plane->transform = glm::translate(glm::mat4(1.0f), glm::vec3(0, -1, 0));
+    plane->color = {1, 0, 0};
+    
+    scene.generate_acceleration(pool);
+    
+    return true;
+}
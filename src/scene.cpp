@@ -1,100 +1,327 @@
 #include "scene.h"
+#include "stats.h"
 
 #include <glm/gtx/perpendicular.hpp>
 
+#define TINYOBJLOADER_IMPLEMENTATION
+#include <tiny_obj_loader.h>
+
 constexpr double pi = 3.14159265358979323846l;
 
-glm::vec3 fetch_position(const Object& object, const tinyobj::mesh_t& mesh, const int32_t index, const int32_t vertex) {
+glm::vec3 fetch_position(const Mesh& mesh_data, const tinyobj::mesh_t& mesh, const int32_t index, const int32_t vertex) {
     const tinyobj::index_t idx = mesh.indices[(index * 3) + vertex];
     
-    const auto vx = object.attrib.vertices[3 * idx.vertex_index];
-    const auto vy = object.attrib.vertices[3 * idx.vertex_index + 1];
-    const auto vz = object.attrib.vertices[3 * idx.vertex_index + 2];
+    const auto vx = mesh_data.attrib.vertices[3 * idx.vertex_index];
+    const auto vy = mesh_data.attrib.vertices[3 * idx.vertex_index + 1];
+    const auto vz = mesh_data.attrib.vertices[3 * idx.vertex_index + 2];
     
     return glm::vec3(vx, vy, vz);
 }
 
-glm::vec3 fetch_normal(const Object& object, const tinyobj::mesh_t& mesh, const int32_t index, const int32_t vertex) {
+glm::vec3 fetch_normal(const Mesh& mesh_data, const tinyobj::mesh_t& mesh, const int32_t index, const int32_t vertex) {
     const tinyobj::index_t idx = mesh.indices[(index * 3) + vertex];
     
-    const auto nx = object.attrib.normals[3 * idx.normal_index];
-    const auto ny = object.attrib.normals[3 * idx.normal_index + 1];
-    const auto nz = object.attrib.normals[3 * idx.normal_index + 2];
+    const auto nx = mesh_data.attrib.normals[3 * idx.normal_index];
+    const auto ny = mesh_data.attrib.normals[3 * idx.normal_index + 1];
+    const auto nz = mesh_data.attrib.normals[3 * idx.normal_index + 2];
     
     return glm::vec3(nx, ny, nz);
 }
 
-bool test_triangle(const Ray ray, const Object& object, const tinyobj::mesh_t& mesh, const size_t i, float& tClosest, bool& intersection, HitResult& result) {
-    const glm::vec3 v0 = fetch_position(object, mesh, i, 0) + object.position;
-    const glm::vec3 v1 = fetch_position(object, mesh, i, 1) + object.position;
-    const glm::vec3 v2 = fetch_position(object, mesh, i, 2) + object.position;
+// ray is the object space one the hit was found with, the result is brought back into world space
+void fill_hit(const Ray ray, const Object& object, const TriangleHit& hit, HitResult& result) {
+    const Mesh& mesh_data = *object.mesh;
+    const tinyobj::mesh_t& mesh = *mesh_data.triangles.meshes[hit.index];
+    const uint32_t face = mesh_data.triangles.faces[hit.index];
+    
+    const glm::vec3 n0 = fetch_normal(mesh_data, mesh, face, 0);
+    const glm::vec3 n1 = fetch_normal(mesh_data, mesh, face, 1);
+    const glm::vec3 n2 = fetch_normal(mesh_data, mesh, face, 2);
+    
+    const glm::vec3 normal = (1 - hit.u - hit.v) * n0 + hit.u * n1 + hit.v * n2;
+    const glm::vec3 position = ray.origin + ray.direction * hit.t;
+    
+    result.normal = glm::normalize(object.normal_matrix * normal);
+    result.position = glm::vec3(object.transform * glm::vec4(position, 1.0f));
+    result.object = &object;
+}
+
+// tests the object's triangles in [begin, end) at once, through the simd kernel where available
+bool test_triangles(const Ray ray, const Object& object, const size_t begin, const size_t end, float& tClosest, bool& intersection, HitResult& result) {
+    thread_stats.triangles_tested += end - begin;
+    
+    TriangleHit hit;
+    if(object.mesh->triangles.intersect(ray, begin, end, tClosest, hit)) {
+        fill_hit(ray, object, hit, result);
+        
+        tClosest = hit.t;
+        intersection = true;
+        
+        return true;
+    }
+    
+    return false;
+}
+
+bool test_triangle(const Ray ray, const Object& object, const size_t i, float& tClosest, bool& intersection, HitResult& result) {
+    thread_stats.triangles_tested++;
+    
+    TriangleHit hit;
+    if(object.mesh->triangles.intersect_scalar(ray, i, i + 1, tClosest, hit)) {
+        fill_hit(ray, object, hit, result);
+        
+        tClosest = hit.t;
+        intersection = true;
+        
+        return true;
+    }
+    
+    return false;
+}
+
+bool occlude_triangles(const Ray ray, const Object& object, const size_t begin, const size_t end, const float t_max) {
+    thread_stats.triangles_tested += end - begin;
+    
+    TriangleHit hit;
+    return object.mesh->triangles.intersect(ray, begin, end, t_max, hit);
+}
+
+bool occlude_triangle(const Ray ray, const Object& object, const size_t i, const float t_max) {
+    thread_stats.triangles_tested++;
+    
+    TriangleHit hit;
+    return object.mesh->triangles.intersect_scalar(ray, i, i + 1, t_max, hit);
+}
+
+std::optional<HitResult> test_scene(const Ray ray, const Scene& scene) {
+    bool intersection = false;
+    HitResult result = {};
+    float tClosest = std::numeric_limits<float>::infinity();
+    
+    for(auto& object : scene.objects)
+        test_triangles(object->to_object_space(ray), *object, 0, object->mesh->triangles.size(), tClosest, intersection, result);
+    
+    if(intersection)
+        return result;
+    else
+        return {};
+}
+
+bool occluded_scene(const Ray ray, const Scene& scene, const float t_max) {
+    for(auto& object : scene.objects) {
+        if(occlude_triangles(object->to_object_space(ray), *object, 0, object->mesh->triangles.size(), t_max))
+            return true;
+    }
+    
+    return false;
+}
+
+// walks every leaf the ray reaches before t_max, nearest first, calling visit with the range of primitive indices each
+// one covers. for triangles this is also the range in the object's TriangleBuffer, since that is kept in leaf order.
+// visit may shorten t_max as closer hits are found, or return true to stop the traversal altogether
+template<typename T, typename Visitor>
+bool traverse_bvh(const BVH<T>& bvh, const Ray ray, const float& t_max, Visitor visit) {
+    struct StackEntry {
+        uint32_t node_index;
+        float t_entry;
+    };
+    
+    if(bvh.nodes.empty())
+        return false;
+    
+    std::array<StackEntry, bvh_max_depth> stack;
+    int stack_size = 0;
+    
+    // counted locally and handed to thread_stats on the way out, keeps the loop free of thread local accesses
+    uint64_t nodes_visited = 0;
+    
+    float t_entry;
+    if(bvh.nodes[0].extent.intersect(ray, t_max, t_entry))
+        stack[stack_size++] = {0, t_entry};
     
-    float t = std::numeric_limits<float>::infinity(), u, v;
-    if(intersections::ray_triangle(ray, v0, v1, v2, t, u, v)) {
-        if(t < tClosest && t > epsilon) {
-            const glm::vec3 n0 = fetch_normal(object, mesh, i, 0);
-            const glm::vec3 n1 = fetch_normal(object, mesh, i, 1);
-            const glm::vec3 n2 = fetch_normal(object, mesh, i, 2);
+    while(stack_size > 0) {
+        const StackEntry entry = stack[--stack_size];
+        
+        // something closer was already found since this node was pushed
+        if(entry.t_entry > t_max)
+            continue;
+        
+        uint32_t node_index = entry.node_index;
+        
+        // descend into the nearest child directly, and only keep the farther one around for later
+        while(!bvh.nodes[node_index].is_leaf()) {
+            const BVHNode& node = bvh.nodes[node_index];
+            nodes_visited++;
+            
+            uint32_t near_index = node_index + 1, far_index = node.offset;
+            float t_near = 0.0f, t_far = 0.0f;
+            bool hit_near = bvh.nodes[near_index].extent.intersect(ray, t_max, t_near);
+            bool hit_far = bvh.nodes[far_index].extent.intersect(ray, t_max, t_far);
+            
+            if(hit_near && hit_far && t_far < t_near) {
+                std::swap(near_index, far_index);
+                std::swap(t_near, t_far);
+            } else if(!hit_near && hit_far) {
+                std::swap(near_index, far_index);
+                std::swap(t_near, t_far);
+                std::swap(hit_near, hit_far);
+            }
             
-            result.normal = (1 - u - v) * n0 + u * n1 + v * n2;
-            result.position = ray.origin + ray.direction * t;
+            if(!hit_near)
+                break;
             
-            tClosest = t;
-            intersection = true;
+            if(hit_far)
+                stack[stack_size++] = {far_index, t_far};
             
+            node_index = near_index;
+        }
+        
+        const BVHNode& node = bvh.nodes[node_index];
+        if(!node.is_leaf())
+            continue;
+        
+        nodes_visited++;
+        
+        if(visit(node.offset, node.offset + node.count)) {
+            thread_stats.nodes_visited += nodes_visited;
             return true;
         }
     }
+    
+    thread_stats.nodes_visited += nodes_visited;
+    
+    return false;
 }
 
-std::optional<HitResult> test_mesh(const Ray ray, const Object& object, const tinyobj::mesh_t& mesh, float& tClosest) {
-    bool intersection = false;
-    HitResult result = {};
+// walks the scene's top level bvh, calling visit with every object whose bounds the ray reaches before t_max and the
+// ray moved into that object's space. same contract as traverse_bvh otherwise, so the per-object traversals can
+// shorten t_max or stop early
+template<typename Visitor>
+bool traverse_objects(const Scene& scene, const Ray ray, const float& t_max, Visitor visit) {
+    if(!scene.top_level)
+        return false;
     
-    for(size_t i = 0; i < mesh.num_face_vertices.size(); i++) {
-        const glm::vec3 v0 = fetch_position(object, mesh, i, 0) + object.position;
-        const glm::vec3 v1 = fetch_position(object, mesh, i, 1) + object.position;
-        const glm::vec3 v2 = fetch_position(object, mesh, i, 2) + object.position;
-        
-        float t = std::numeric_limits<float>::infinity(), u, v;
-        if(intersections::ray_triangle(ray, v0, v1, v2, t, u, v)) {
-            if(t < tClosest && t > epsilon) {
-                const glm::vec3 n0 = fetch_normal(object, mesh, i, 0);
-                const glm::vec3 n1 = fetch_normal(object, mesh, i, 1);
-                const glm::vec3 n2 = fetch_normal(object, mesh, i, 2);
-                
-                result.normal = (1 - u - v) * n0 + u * n1 + v * n2;
-                result.position = ray.origin + ray.direction * t;
-                
-                tClosest = t;
-                
-                intersection = true;
+    return traverse_bvh(*scene.top_level, ray, t_max, [&](const uint32_t begin, const uint32_t end) {
+        for(uint32_t i = begin; i < end; i++) {
+            const Object& object = *scene.objects[scene.top_level->primitives[i].object_index];
+            
+            if(visit(object, object.to_object_space(ray)))
+                return true;
+        }
+        
+        return false;
+    });
+}
+
+// orders the first count entries by t_entry, farthest first. an insertion sort, since there are never more than eight
+// and std::sort over the partly filled array trips -Warray-bounds
+template<typename Entry, size_t size>
+void sort_far_to_near(std::array<Entry, size>& entries, const int count) {
+    for(int i = 1; i < count; i++) {
+        const Entry entry = entries[i];
+        
+        int j = i - 1;
+        for(; j >= 0 && entries[j].t_entry < entry.t_entry; j--)
+            entries[j + 1] = entries[j];
+        
+        entries[j + 1] = entry;
+    }
+}
+
+// same contract as traverse_bvh, except visit is called for each primitive in a leaf
+template<typename T, typename Visitor>
+bool traverse_octree(const Octree<T>& octree, const Ray ray, const float& t_max, Visitor visit) {
+    struct StackEntry {
+        const Node<T>* node;
+        float t_entry;
+    };
+    
+    std::array<StackEntry, octree_stack_size> stack;
+    int stack_size = 0;
+    
+    uint64_t nodes_visited = 0;
+    
+    float t_entry;
+    if(octree.root.extent.intersect(ray, t_max, t_entry))
+        stack[stack_size++] = {&octree.root, t_entry};
+    
+    while(stack_size > 0) {
+        const StackEntry entry = stack[--stack_size];
+        
+        // something closer was already found since this node was pushed
+        if(entry.t_entry > t_max)
+            continue;
+        
+        nodes_visited++;
+        
+        if(entry.node->is_split) {
+            std::array<StackEntry, 8> hit_children;
+            int num_hit_children = 0;
+            
+            for(auto& child : entry.node->children) {
+                if(child->extent.intersect(ray, t_max, t_entry))
+                    hit_children[num_hit_children++] = {child.get(), t_entry};
+            }
+            
+            // push the farthest child first, so the nearest one is popped next
+            sort_far_to_near(hit_children, num_hit_children);
+            
+            for(int i = 0; i < num_hit_children; i++)
+                stack[stack_size++] = hit_children[i];
+        } else {
+            for(auto& triangle_object : entry.node->contained_objects) {
+                if(visit(triangle_object)) {
+                    thread_stats.nodes_visited += nodes_visited;
+                    return true;
+                }
             }
         }
     }
     
+    thread_stats.nodes_visited += nodes_visited;
+    
+    return false;
+}
+
+std::optional<HitResult> test_scene_octree(const Ray ray, const Scene& scene) {
+    bool intersection = false;
+    HitResult result = {};
+    float tClosest = std::numeric_limits<float>::infinity();
+    
+    traverse_objects(scene, ray, tClosest, [&](const Object& object, const Ray local_ray) {
+        return traverse_octree(*object.mesh->octree, local_ray, tClosest, [&](const TriangleBox& triangle_object) {
+            test_triangle(local_ray, object, triangle_object.triangle_index, tClosest, intersection, result);
+            
+            return false;
+        });
+    });
+    
     if(intersection)
         return result;
     else
         return {};
 }
 
-std::optional<HitResult> test_scene(const Ray ray, const Scene& scene) {
+bool occluded_scene_octree(const Ray ray, const Scene& scene, const float t_max) {
+    return traverse_objects(scene, ray, t_max, [&](const Object& object, const Ray local_ray) {
+        return traverse_octree(*object.mesh->octree, local_ray, t_max, [&](const TriangleBox& triangle_object) {
+            return occlude_triangle(local_ray, object, triangle_object.triangle_index, t_max);
+        });
+    });
+}
+
+std::optional<HitResult> test_scene_bvh(const Ray ray, const Scene& scene) {
     bool intersection = false;
     HitResult result = {};
     float tClosest = std::numeric_limits<float>::infinity();
     
-    for(auto& object : scene.objects) {
-        for(uint32_t i = 0; i < object->shapes.size(); i++) {
-            auto mesh = object->shapes[i].mesh;
+    traverse_objects(scene, ray, tClosest, [&](const Object& object, const Ray local_ray) {
+        return traverse_bvh(*object.mesh->bvh, local_ray, tClosest, [&](const uint32_t begin, const uint32_t end) {
+            test_triangles(local_ray, object, begin, end, tClosest, intersection, result);
             
-            if(const auto hit = test_mesh(ray, *object, mesh, tClosest)) {
-                intersection = true;
-                result = hit.value();
-                result.object = object.get();
-            }
-        }
-    }
+            return false;
+        });
+    });
     
     if(intersection)
         return result;
@@ -102,40 +329,87 @@ std::optional<HitResult> test_scene(const Ray ray, const Scene& scene) {
         return {};
 }
 
-template<typename T>
-Node<T>* find_hit_ray_search(Node<T>& node, const Ray ray, std::vector<Node<T>*>* out) {
-    if(node.extent.contains(ray)) {
-        if(node.is_split) {
-            for(auto& child : node.children)
-                find_hit_ray_search(*child, ray, out);
-        } else {
-            out->push_back(&node);
-        }
-    }
+bool occluded_scene_bvh(const Ray ray, const Scene& scene, const float t_max) {
+    return traverse_objects(scene, ray, t_max, [&](const Object& object, const Ray local_ray) {
+        return traverse_bvh(*object.mesh->bvh, local_ray, t_max, [&](const uint32_t begin, const uint32_t end) {
+            return occlude_triangles(local_ray, object, begin, end, t_max);
+        });
+    });
 }
 
-template<typename T>
-std::vector<Node<T>*> find_hit_ray(Node<T>& node, const Ray ray) {
-    std::vector<Node<T>*> vec;
+// same contract as traverse_bvh
+template<typename Visitor>
+bool traverse_wide_bvh(const WideBVH& bvh, const Ray ray, const float& t_max, Visitor visit) {
+    struct StackEntry {
+        uint32_t offset, count;
+        float t_entry;
+    };
     
-    find_hit_ray_search(node, ray, &vec);
+    if(bvh.nodes.empty())
+        return false;
     
-    return vec;
+    std::array<StackEntry, wide_bvh_stack_size> stack;
+    int stack_size = 0;
+    
+    uint64_t nodes_visited = 0;
+    
+    stack[stack_size++] = {0, 0, 0.0f};
+    
+    while(stack_size > 0) {
+        const StackEntry entry = stack[--stack_size];
+        
+        // something closer was already found since this node was pushed
+        if(entry.t_entry > t_max)
+            continue;
+        
+        nodes_visited++;
+        
+        if(entry.count > 0) {
+            if(visit(entry.offset, entry.offset + entry.count)) {
+                thread_stats.nodes_visited += nodes_visited;
+                return true;
+            }
+            
+            continue;
+        }
+        
+        const WideBVHNode& node = bvh.nodes[entry.offset];
+        
+        std::array<float, wide_bvh_width> t_entry;
+        const int hit_mask = node.intersect(ray, t_max, t_entry);
+        
+        std::array<StackEntry, wide_bvh_width> hit_children;
+        int num_hit_children = 0;
+        
+        for(int i = 0; i < wide_bvh_width; i++) {
+            if(hit_mask & (1 << i))
+                hit_children[num_hit_children++] = {node.offset[i], node.count[i], t_entry[i]};
+        }
+        
+        // push the farthest child first, so the nearest one is popped next
+        sort_far_to_near(hit_children, num_hit_children);
+        
+        for(int i = 0; i < num_hit_children; i++)
+            stack[stack_size++] = hit_children[i];
+    }
+    
+    thread_stats.nodes_visited += nodes_visited;
+    
+    return false;
 }
 
-std::optional<HitResult> test_scene_octree(const Ray ray, const Scene& scene) {
+std::optional<HitResult> test_scene_wide_bvh(const Ray ray, const Scene& scene) {
     bool intersection = false;
     HitResult result = {};
     float tClosest = std::numeric_limits<float>::infinity();
     
-    for(auto& object : scene.objects) {
-        for(auto& node : find_hit_ray(object->octree->root, ray)) {
-            for(auto& triangle_object : node->contained_objects) {
-                if(test_triangle(ray, *object, *triangle_object.mesh, triangle_object.vertice_index, tClosest, intersection, result))
-                    result.object = object.get();
-            }
-        }
-    }
+    traverse_objects(scene, ray, tClosest, [&](const Object& object, const Ray local_ray) {
+        return traverse_wide_bvh(*object.mesh->wide_bvh, local_ray, tClosest, [&](const uint32_t begin, const uint32_t end) {
+            test_triangles(local_ray, object, begin, end, tClosest, intersection, result);
+            
+            return false;
+        });
+    });
     
     if(intersection)
         return result;
@@ -143,6 +417,14 @@ std::optional<HitResult> test_scene_octree(const Ray ray, const Scene& scene) {
         return {};
 }
 
+bool occluded_scene_wide_bvh(const Ray ray, const Scene& scene, const float t_max) {
+    return traverse_objects(scene, ray, t_max, [&](const Object& object, const Ray local_ray) {
+        return traverse_wide_bvh(*object.mesh->wide_bvh, local_ray, t_max, [&](const uint32_t begin, const uint32_t end) {
+            return occlude_triangles(local_ray, object, begin, end, t_max);
+        });
+    });
+}
+
 // methods adapated from https://users.cg.tuwien.ac.at/zsolnai/gfx/smallpaint/
 std::tuple<glm::vec3, glm::vec3> orthogonal_system(const glm::vec3& v1) {
     glm::vec3 v2;
@@ -159,65 +441,133 @@ std::tuple<glm::vec3, glm::vec3> orthogonal_system(const glm::vec3& v1) {
     return {v2, glm::cross(v1, v2)};
 }
 
-glm::vec3 hemisphere(const double u1, const double u2) {
-    const double r = sqrt(1.0 - u1 * u1);
-    const double phi = 2 * M_PI * u2;
+glm::vec3 cosine_hemisphere(const float u1, const float u2) {
+    const float r = sqrtf(u1);
+    const float phi = 2.0f * static_cast<float>(pi) * u2;
+    
+    return glm::vec3(cosf(phi) * r, sinf(phi) * r, sqrtf(std::max(1.0f - u1, 0.0f)));
+}
+
+glm::vec3 uniform_hemisphere(const float u1, const float u2) {
+    const float r = sqrtf(std::max(1.0f - u1 * u1, 0.0f));
+    const float phi = 2.0f * static_cast<float>(pi) * u2;
     
-    return glm::vec3(cos(phi) * r, sin(phi) * r, u1);
+    return glm::vec3(cosf(phi) * r, sinf(phi) * r, u1);
+}
+
+glm::vec3 around_normal(const glm::vec3& normal, const glm::vec3& direction) {
+    const auto [rotX, rotY] = orthogonal_system(normal);
+    
+    return {
+        glm::dot({rotX.x, rotY.x, normal.x}, direction),
+        glm::dot({rotX.y, rotY.y, normal.y}, direction),
+        glm::dot({rotX.z, rotY.z, normal.z}, direction)
+    };
 }
 
 glm::vec3 reflect(const glm::vec3& I, const glm::vec3& N) {
     return I - 2 * glm::dot(I, N) * N;
 }
 
-std::optional<SceneResult> cast_scene(const Ray ray, Scene& scene, const bool use_bvh, const int depth) {
+std::function<decltype(test_scene)> scene_function(const Accelerator accelerator) {
+    switch(accelerator) {
+        case Accelerator::None:
+            return test_scene;
+        case Accelerator::Octree:
+            return test_scene_octree;
+        case Accelerator::BVH:
+            return test_scene_bvh;
+        case Accelerator::WideBVH:
+            return test_scene_wide_bvh;
+    }
+    
+    return test_scene;
+}
+
+std::function<decltype(occluded_scene)> occlusion_function(const Accelerator accelerator) {
+    switch(accelerator) {
+        case Accelerator::None:
+            return occluded_scene;
+        case Accelerator::Octree:
+            return occluded_scene_octree;
+        case Accelerator::BVH:
+            return occluded_scene_bvh;
+        case Accelerator::WideBVH:
+            return occluded_scene_wide_bvh;
+    }
+    
+    return occluded_scene;
+}
+
+glm::vec3 direct_light(const HitResult& hit, const Scene& scene, const std::function<decltype(occluded_scene)>& occlusion_func) {
+    // currently only supports only one light (directional)
+    if(glm::dot(light_position - hit.position, hit.normal) <= 0)
+        return glm::vec3(0);
+    
+    const float diffuse = lighting::point_light(hit.position, light_position, hit.normal);
+    const glm::vec3 light_dir = glm::normalize(light_position - hit.position);
+    
+    const Ray shadow_ray(hit.position + (hit.normal * light_bias), light_dir);
+    const float light_distance = glm::length(light_position - shadow_ray.origin);
+    
+    thread_stats.count_ray(RayType::Shadow);
+    const float shadow = occlusion_func(shadow_ray, scene, light_distance) ? 0.0f : 1.0f;
+    
+    return hit.object->color * diffuse * shadow;
+}
+
+// picks a direction in the hemisphere around the normal for a diffuse bounce. directions are drawn proportional to the
+// cosine term of the diffuse brdf, which cancels against the pdf, so every sample is weighted the same
+glm::vec3 sample_indirect(const glm::vec3& normal, Random& random) {
+    const float u1 = random.uniform();
+    const float u2 = random.uniform();
+    
+    return around_normal(normal, cosine_hemisphere(u1, u2));
+}
+
+glm::vec3 bounce_origin(const HitResult& hit) {
+    return hit.position + hit.normal * light_bias;
+}
+
+std::optional<SceneResult> cast_scene(const Ray ray, const Scene& scene, Random& random, const Accelerator accelerator, const int indirect_samples, const int depth) {
     if(depth > max_depth)
         return {};
     
-    const std::function<decltype(test_scene)> scene_func = use_bvh ? test_scene_octree : test_scene;
+    const std::function<decltype(test_scene)> scene_func = scene_function(accelerator);
+    const std::function<decltype(occluded_scene)> occlusion_func = occlusion_function(accelerator);
+    
+    if(depth == 0)
+        thread_stats.count_ray(RayType::Primary);
     
     if(auto hit = scene_func(ray, scene)) {
-        const float diffuse = lighting::point_light(hit->position, light_position, hit->normal);
         SceneResult result = {};
-
-        // direct lighting calculation
-        // currently only supports only one light (directional)
-        if(glm::dot(light_position - hit->position, hit->normal) > 0) {
-            const glm::vec3 light_dir = glm::normalize(light_position - hit->position);
-            
-            const Ray shadow_ray(hit->position + (hit->normal * light_bias), light_dir);
         
-            const float shadow = scene_func(shadow_ray, scene) ? 0.0f : 1.0f;
-            
-            result.direct = hit->object->color * diffuse * shadow;
-        }
+        result.direct = direct_light(*hit, scene, occlusion_func);
+        
+        // the calls one level past max_depth return before casting anything, so they aren't counted
+        const bool casts_bounces = depth < max_depth;
+        
+        if(casts_bounces)
+            thread_stats.count_ray(RayType::Reflection);
         
-        if(auto reflect_result = cast_scene(Ray(hit->position, glm::reflect(ray.direction, hit->normal)), scene, use_bvh, depth + 1))
-            result.reflect = reflect_result->combined;
+        if(auto reflect_result = cast_scene(Ray(bounce_origin(*hit), glm::reflect(ray.direction, hit->normal)), scene, random, accelerator, indirect_samples, depth + 1))
+            result.reflect = mirror_albedo * reflect_result->combined;
         
         // indirect lighting calculation
-        // we take a hemisphere orthogonal to the normal, and take a constant number of num_indirect_samples
-        // and naive monte carlo without PDF
-        if(num_indirect_samples > 0) {
-            for(int i = 0; i < num_indirect_samples; i++) {
-                const float theta = scene.distribution() * pi;
-                const float cos_theta = cos(theta);
-                const float sin_theta = sin(theta);
+        // monte carlo estimate of the light reflected by the diffuse lobe, using indirect_samples cosine
+        // distributed directions
+        if(indirect_samples > 0) {
+            for(int i = 0; i < indirect_samples; i++) {
+                const glm::vec3 direction = sample_indirect(hit->normal, random);
                 
-                const auto [rotX, rotY] = orthogonal_system(hit->normal);
+                if(casts_bounces)
+                    thread_stats.count_ray(RayType::Indirect);
                 
-                const glm::vec3 sampled_dir = hemisphere(cos_theta, sin_theta);
-                const glm::vec3 rotated_dir = {
-                    glm::dot({rotX.x, rotY.x, hit->normal.x}, sampled_dir),
-                    glm::dot({rotX.y, rotY.y, hit->normal.y}, sampled_dir),
-                    glm::dot({rotX.z, rotY.z, hit->normal.z}, sampled_dir)
-                };
-                
-                if(const auto indirect_result = cast_scene(Ray(ray.origin, rotated_dir), scene, use_bvh, depth + 1))
-                    result.indirect += indirect_result->combined * cos_theta;
+                if(const auto indirect_result = cast_scene(Ray(bounce_origin(*hit), direction), scene, random, accelerator, indirect_samples, depth + 1))
+                    result.indirect += indirect_result->combined;
             }
             
-            result.indirect /= num_indirect_samples;
+            result.indirect *= diffuse_albedo * hit->object->color / static_cast<float>(indirect_samples);
         }
         
         result.hit = *hit;
@@ -228,3 +578,71 @@ std::optional<SceneResult> cast_scene(const Ray ray, Scene& scene, const bool us
         return {};
     }
 }
+
+std::optional<SceneResult> trace_path(const Ray ray, const Scene& scene, Random& random, const Accelerator accelerator, const int max_bounces) {
+    const std::function<decltype(test_scene)> scene_func = scene_function(accelerator);
+    const std::function<decltype(occluded_scene)> occlusion_func = occlusion_function(accelerator);
+    
+    thread_stats.count_ray(RayType::Primary);
+    
+    auto hit = scene_func(ray, scene);
+    if(!hit)
+        return {};
+    
+    SceneResult result = {};
+    result.hit = *hit;
+    result.direct = direct_light(*hit, scene, occlusion_func);
+    
+    // the rest of the path counts towards whichever lobe the first bounce took
+    glm::vec3* first_lobe = nullptr;
+    
+    // throughput weights the light found further along the path, making up for the lobes and paths that weren't
+    // followed. energy is only the product of the albedos along the way, how much of that light is left on average,
+    // which is what decides whether a path is worth going on with
+    glm::vec3 throughput(1.0f);
+    glm::vec3 energy(1.0f);
+    glm::vec3 direction = ray.direction;
+    
+    for(int bounce = 0; bounce < max_bounces; bounce++) {
+        if(bounce >= russian_roulette_depth) {
+            const float survival = std::min(std::max(std::max(energy.x, energy.y), energy.z), 0.95f);
+            
+            if(random.uniform() >= survival)
+                break;
+            
+            throughput /= survival;
+        }
+        
+        // cast_scene follows both the mirror and the diffuse lobe, here one of them is picked with equal odds
+        // and weighted twice to make up for the other
+        glm::vec3* lobe;
+        glm::vec3 albedo;
+        if(random.uniform() < 0.5f) {
+            direction = glm::reflect(direction, hit->normal);
+            lobe = &result.reflect;
+            albedo = glm::vec3(mirror_albedo);
+            thread_stats.count_ray(RayType::Reflection);
+        } else {
+            direction = sample_indirect(hit->normal, random);
+            lobe = &result.indirect;
+            albedo = diffuse_albedo * hit->object->color;
+            thread_stats.count_ray(RayType::Indirect);
+        }
+        
+        throughput *= 2.0f * albedo;
+        energy *= albedo;
+        
+        if(bounce == 0)
+            first_lobe = lobe;
+        
+        hit = scene_func(Ray(bounce_origin(*hit), direction), scene);
+        if(!hit)
+            break;
+        
+        *first_lobe += throughput * direct_light(*hit, scene, occlusion_func);
+    }
+    
+    result.combined = (result.indirect + result.direct + result.reflect);
+    
+    return result;
+}